@@ -1,209 +1,3719 @@
 #include <iostream>
 #include <fstream>
 #include <queue>
-#include <unordered_map>
 #include <vector>
-#include <bitset>
 #include <string>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <deque>
+#include <memory>
+#include <cstdlib>
+#include <cerrno>
+#include <cctype>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <atomic>
+#include <filesystem>
+// The SSE4.2 CRC32C path is compiled for x86-64 regardless of the target flags and
+// chosen at run time, so a portable build still uses it on CPUs that have it
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CRC32C_RUNTIME_DISPATCH 1
+#include <immintrin.h>
+#endif
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Everything lives in file_compression, so a program built with the codec (see
+// FILE_COMPRESSION_NO_MAIN at the end) sees no generic global names. Only the embedding
+// interface is outside the anonymous namespace: CompressionOptions, loadDictionary,
+// InputSpan, OutputSpan and StreamCompressor, plus the plain types they hold.
+namespace file_compression {
 using namespace std;
 
-// Huffman Tree Node
+namespace {
+
+const size_t DEFAULT_BLOCK_SIZE = 1 << 20; // Bytes per independently coded block
+const size_t MAX_BLOCK_SIZE = 1 << 26;     // Largest block a decoder will accept
+const size_t MIN_LIMITED_BLOCK_SIZE = 64 << 10; // Smallest block a memory limit may shrink blocks to
+const size_t MEMORY_RESERVE = 8 << 20;     // Part of a memory limit kept for code, stacks and stream buffers
+const int MAX_CODE_LENGTH = 32;   // Longest code: fits a 32-bit code word and a refilled bit buffer
+const int DECODE_TABLE_BITS = 11; // Index width of the primary decode table
+const int DEFAULT_CODE_LENGTH_LIMIT = 11; // Encoder cap on code lengths: every code fits the primary table
+
+// Huffman Tree Node; children are indices into the owning tree's node arena
 struct HuffmanNode {
-    char data;
-    unsigned freq;
-    HuffmanNode *left, *right;
+    uint32_t freq;
+    int16_t left, right; // -1 for leaves
+    uint8_t data;
+};
+
+// Huffman tree in a fixed arena: 256 leaves plus at most 255 internal nodes.
+// Building a tree performs no heap allocation; rebuilding simply overwrites it.
+struct HuffmanTree {
+    HuffmanNode nodes[511];
+    int count = 0;
+    int root = -1;
+    
+    void reset() {
+        count = 0;
+        root = -1;
+    }
+    
+    int addNode(uint32_t freq, int left, int right, uint8_t data) {
+        nodes[count] = {freq, static_cast<int16_t>(left), static_cast<int16_t>(right), data};
+        return count++;
+    }
+};
+
+// Build Huffman Tree into `tree` with the two-queue method and return its root
+// (-1 if every frequency is zero). Leaves are placed in the arena sorted by
+// frequency and internal nodes are created in nondecreasing frequency order, so
+// the two halves of the arena are the two queues and construction is linear.
+int buildHuffmanTree(const uint32_t freq[256], HuffmanTree &tree) {
+    tree.reset();
+    
+    // Leaves sorted by frequency, ties by symbol value
+    uint8_t symbols[256];
+    int leafCount = 0;
+    for (int s = 0; s < 256; s++) {
+        if (freq[s]) symbols[leafCount++] = static_cast<uint8_t>(s);
+    }
+    if (leafCount == 0) return -1;
+    stable_sort(symbols, symbols + leafCount, [freq](uint8_t a, uint8_t b) { return freq[a] < freq[b]; });
+    for (int i = 0; i < leafCount; i++) {
+        tree.addNode(freq[symbols[i]], -1, -1, symbols[i]);
+    }
+    
+    // Repeatedly merge the two smallest heads of the leaf and internal queues
+    int nextLeaf = 0, nextInternal = leafCount;
+    auto takeSmallest = [&]() {
+        if (nextLeaf < leafCount &&
+            (nextInternal == tree.count || tree.nodes[nextLeaf].freq <= tree.nodes[nextInternal].freq)) {
+            return nextLeaf++;
+        }
+        return nextInternal++;
+    };
+    for (int merges = 1; merges < leafCount; merges++) {
+        int left = takeSmallest();
+        int right = takeSmallest();
+        tree.addNode(tree.nodes[left].freq + tree.nodes[right].freq, left, right, 0);
+    }
+    
+    tree.root = tree.count - 1;
+    return tree.root;
+}
+
+// Collect the depth of every leaf, which is the code length of its symbol. Parents
+// always follow their children in the arena, so one backwards pass sets every depth.
+void collectCodeLengths(const HuffmanTree &tree, uint8_t lengths[256]) {
+    int depth[511];
+    if (tree.root < 0) return;
+    depth[tree.root] = 0;
+    for (int i = tree.root; i >= 0; i--) {
+        const HuffmanNode &n = tree.nodes[i];
+        if (n.left >= 0) {
+            depth[n.left] = depth[n.right] = depth[i] + 1;
+        } else {
+            // A lone symbol still needs one bit per occurrence
+            lengths[n.data] = static_cast<uint8_t>(max(depth[i], 1));
+        }
+    }
+}
+
+// Optimal length-limited code lengths by package-merge. Each of `maxLength` levels
+// merges the sorted leaves with pairs ("packages") of the level below; the cheapest
+// 2n - 2 items of the last level are expanded, and every appearance of a leaf adds
+// one bit to its code. Items live in fixed arrays, so no allocation is needed.
+void packageMergeCodeLengths(const HuffmanTree &tree, uint8_t lengths[256], int maxLength) {
+    struct Item {
+        uint64_t weight;
+        int16_t first;  // Leaf index for leaves; first child in the level below for packages
+        bool isPackage;
+    };
+    static const int MAX_LEVELS = MAX_CODE_LENGTH;
+    static thread_local Item levels[MAX_LEVELS][511];
+    int levelSize[MAX_LEVELS];
+    int leafCount = (tree.count + 1) / 2;
+    maxLength = min(maxLength, MAX_LEVELS);
+    
+    for (int level = 0; level < maxLength; level++) {
+        // Packages from adjacent pairs of the level below, merged with the leaves
+        int packages = level == 0 ? 0 : levelSize[level - 1] / 2;
+        int leaf = 0, package = 0, size = 0;
+        while (leaf < leafCount || package < packages) {
+            uint64_t packageWeight = package < packages
+                ? levels[level - 1][2 * package].weight + levels[level - 1][2 * package + 1].weight : 0;
+            if (package == packages || (leaf < leafCount && tree.nodes[leaf].freq <= packageWeight)) {
+                levels[level][size++] = {tree.nodes[leaf].freq, static_cast<int16_t>(leaf), false};
+                leaf++;
+            } else {
+                levels[level][size++] = {packageWeight, static_cast<int16_t>(2 * package), true};
+                package++;
+            }
+            if (size == 2 * leafCount - 2) break; // Items past this point are never selected
+        }
+        levelSize[level] = size;
+    }
+    
+    // Expand the selected items level by level; `selected` counts items taken per level
+    int bits[256] = {0};
+    int selected = 2 * leafCount - 2;
+    for (int level = maxLength - 1; level >= 0 && selected > 0; level--) {
+        int packagesTaken = 0;
+        for (int i = 0; i < selected; i++) {
+            const Item &item = levels[level][i];
+            if (item.isPackage) {
+                packagesTaken++;
+            } else {
+                bits[item.first]++;
+            }
+        }
+        selected = 2 * packagesTaken;
+    }
+    
+    for (int i = 0; i < leafCount; i++) {
+        lengths[tree.nodes[i].data] = static_cast<uint8_t>(bits[i]);
+    }
+}
+
+// Optimal code lengths for a histogram, limited to `maxLength` bits
+void computeCodeLengths(const uint32_t freq[256], uint8_t lengths[256], int maxLength = DEFAULT_CODE_LENGTH_LIMIT) {
+    HuffmanTree tree;
+    memset(lengths, 0, 256);
+    buildHuffmanTree(freq, tree);
+    collectCodeLengths(tree, lengths);
+    
+    // Package-merge only when the plain Huffman code breaks the limit; "unlimited"
+    // still respects the 32-bit code word
+    int leafCount = (tree.count + 1) / 2;
+    if (maxLength <= 0 || maxLength > MAX_CODE_LENGTH) maxLength = MAX_CODE_LENGTH;
+    if (leafCount < 2) return;
+    int longest = 0;
+    for (int i = 0; i < leafCount; i++) longest = max(longest, static_cast<int>(lengths[tree.nodes[i].data]));
+    if (longest > maxLength) packageMergeCodeLengths(tree, lengths, max(maxLength, 9));
+}
+
+// Assign canonical codes: shorter codes first, ties broken by symbol value
+void assignCanonicalCodes(const uint8_t lengths[256], uint32_t codes[256]) {
+    int lengthCount[MAX_CODE_LENGTH + 2] = {0};
+    for (int s = 0; s < 256; s++) {
+        if (lengths[s]) lengthCount[lengths[s]]++;
+    }
+    
+    uint64_t nextCode[MAX_CODE_LENGTH + 2] = {0};
+    uint64_t code = 0;
+    for (int len = 1; len <= MAX_CODE_LENGTH + 1; len++) {
+        code = (code + lengthCount[len - 1]) << 1;
+        nextCode[len] = code;
+    }
+    
+    for (int s = 0; s < 256; s++) {
+        codes[s] = lengths[s] ? static_cast<uint32_t>(nextCode[lengths[s]]++) : 0;
+    }
+}
+
+} // namespace
+
+// Encoder code table: canonical code and length per byte value, so encoding a byte
+// is two loads and a shift
+struct HuffmanCodeTable {
+    uint32_t code[256];
+    uint8_t length[256];
+};
+
+namespace {
+
+// Generate Huffman codes (canonical, so the decoder only needs the code lengths)
+void generateHuffmanCodes(const uint8_t lengths[256], HuffmanCodeTable &table) {
+    assignCanonicalCodes(lengths, table.code);
+    memcpy(table.length, lengths, 256);
+}
+
+} // namespace
+
+// One probe result of the decode table
+struct DecodeEntry {
+    uint32_t value;    // Up to two symbols (first in the low byte), or the offset of a sub-table
+    uint8_t bits;      // Bits consumed by all decoded symbols, or the index width of the sub-table
+    uint8_t count;     // Symbols decoded by this probe (1 or 2); 0 marks a sub-table link
+    uint8_t firstBits; // Bits consumed by the first symbol alone
+};
+
+// Filler for bit patterns no code uses (only reachable from corrupt input); it still
+// consumes a bit so a bad stream cannot stall the decoder
+const DecodeEntry INVALID_ENTRY = {0, 1, 1, 1};
+
+// Primary table of 2^DECODE_TABLE_BITS entries followed by overflow sub-tables
+struct DecodeTable {
+    vector<DecodeEntry> entries;
+    int maxLength = 0;
+};
+
+namespace {
+
+// Fill one (sub-)table level for the codes sharing the first `consumed` bits
+void fillDecodeLevel(DecodeTable &table, size_t base, int indexBits, int consumed,
+                     const vector<int> &symbols, const uint8_t lengths[256], const uint32_t codes[256]) {
+    size_t i = 0;
+    while (i < symbols.size()) {
+        int s = symbols[i];
+        int rest = lengths[s] - consumed;
+        uint64_t restCode = codes[s] & ((uint64_t(1) << rest) - 1);
+        
+        if (rest <= indexBits) {
+            // Short code: replicate it over every index sharing its prefix
+            size_t first = base + (restCode << (indexBits - rest));
+            size_t span = size_t(1) << (indexBits - rest);
+            for (size_t k = 0; k < span; k++) {
+                table.entries[first + k] = {static_cast<uint32_t>(s), static_cast<uint8_t>(rest), 1,
+                                            static_cast<uint8_t>(rest)};
+            }
+            i++;
+            continue;
+        }
+        
+        // Long codes: group those sharing this level's index into a sub-table
+        uint64_t index = restCode >> (rest - indexBits);
+        vector<int> group;
+        int groupMax = 0;
+        while (i < symbols.size()) {
+            int g = symbols[i];
+            int gRest = lengths[g] - consumed;
+            if (gRest <= indexBits || ((codes[g] & ((uint64_t(1) << gRest) - 1)) >> (gRest - indexBits)) != index) break;
+            group.push_back(g);
+            groupMax = max(groupMax, gRest - indexBits);
+            i++;
+        }
+        
+        int subBits = min(groupMax, DECODE_TABLE_BITS);
+        size_t subBase = table.entries.size();
+        table.entries.resize(subBase + (size_t(1) << subBits), INVALID_ENTRY);
+        table.entries[base + index] = {static_cast<uint32_t>(subBase), static_cast<uint8_t>(subBits), 0, 0};
+        fillDecodeLevel(table, subBase, subBits, consumed + indexBits, group, lengths, codes);
+    }
+}
+
+// Build the decode table from canonical code lengths
+bool buildDecodeTable(const uint8_t lengths[256], DecodeTable &table) {
+    vector<int> symbols;
+    table.maxLength = 0;
+    for (int s = 0; s < 256; s++) {
+        if (lengths[s]) {
+            symbols.push_back(s);
+            table.maxLength = max(table.maxLength, static_cast<int>(lengths[s]));
+        }
+    }
+    if (symbols.empty() || table.maxLength > MAX_CODE_LENGTH) return false;
+    
+    // Reject oversubscribed length sets, which no prefix code can satisfy
+    uint64_t kraft = 0;
+    for (int s : symbols) kraft += uint64_t(1) << (MAX_CODE_LENGTH - lengths[s]);
+    if (kraft > (uint64_t(1) << MAX_CODE_LENGTH)) return false;
+    
+    uint32_t codes[256];
+    assignCanonicalCodes(lengths, codes);
+    
+    // Canonical order: by length, then symbol, which keeps left-aligned codes increasing
+    sort(symbols.begin(), symbols.end(), [&](int a, int b) {
+        return lengths[a] != lengths[b] ? lengths[a] < lengths[b] : a < b;
+    });
+    
+    const size_t primarySize = size_t(1) << DECODE_TABLE_BITS;
+    table.entries.assign(primarySize, INVALID_ENTRY);
+    fillDecodeLevel(table, 0, DECODE_TABLE_BITS, 0, symbols, lengths, codes);
+    
+    // Pair up symbols whose combined codes still fit in one primary index
+    vector<DecodeEntry> single(table.entries.begin(), table.entries.begin() + primarySize);
+    for (size_t i = 0; i < primarySize; i++) {
+        const DecodeEntry &first = single[i];
+        if (first.count != 1 || first.bits >= DECODE_TABLE_BITS) continue;
+        const DecodeEntry &second = single[(i << first.bits) & (primarySize - 1)];
+        if (second.count == 1 && first.bits + second.bits <= DECODE_TABLE_BITS) {
+            table.entries[i] = {first.value | (second.value << 8),
+                                static_cast<uint8_t>(first.bits + second.bits), 2, first.bits};
+        }
+    }
+    return true;
+}
+
+// MSB-first bit reader over a byte buffer, backed by a 64-bit register
+struct BitReader {
+    const uint8_t *pos, *end;
+    uint64_t buffer = 0;
+    int count = 0;
+    
+    BitReader(const uint8_t *data, size_t size) : pos(data), end(data + size) {}
+    
+    // Top up the register to at least 57 valid bits
+    void refill() {
+        if (end - pos >= 8) {
+            uint64_t word = 0;
+            for (int k = 0; k < 8; k++) word = (word << 8) | pos[k];
+            buffer |= word >> count;
+            pos += (63 - count) >> 3;
+            count |= 56;
+        } else {
+            while (count <= 56) {
+                uint64_t byte = pos < end ? *pos++ : 0;
+                buffer |= byte << (56 - count);
+                count += 8;
+            }
+        }
+    }
+    
+    uint32_t peek(int bits) const { return static_cast<uint32_t>(buffer >> (64 - bits)); }
+    void skip(int bits) { buffer <<= bits; count -= bits; }
+};
+
+// MSB-first bit writer: codes collect in a 64-bit register and leave it as 32-bit words
+// written straight into the output, which is sized for the expected coded length up
+// front and trimmed back to what was written by finish()
+struct BitWriter {
+    vector<uint8_t> &sink;
+    uint8_t *cursor;
+    uint8_t *limit;
+    uint64_t acc = 0;
+    int count = 0;
+    
+    explicit BitWriter(vector<uint8_t> &out, size_t expectedBytes = 0) : sink(out) {
+        size_t start = sink.size();
+        sink.resize(start + max<size_t>(expectedBytes, 64));
+        cursor = sink.data() + start;
+        limit = sink.data() + sink.size();
+    }
+    
+    // Append the low `len` bits of `code` (len <= 32)
+    void put(uint32_t code, int len) {
+        acc = (acc << len) | code;
+        count += len;
+        if (count >= 32) {
+            count -= 32;
+            if (limit - cursor < 4) grow();
+            uint32_t word = static_cast<uint32_t>(acc >> count);
+            cursor[0] = static_cast<uint8_t>(word >> 24);
+            cursor[1] = static_cast<uint8_t>(word >> 16);
+            cursor[2] = static_cast<uint8_t>(word >> 8);
+            cursor[3] = static_cast<uint8_t>(word);
+            cursor += 4;
+        }
+    }
+    
+    void grow() {
+        size_t used = cursor - sink.data();
+        sink.resize(sink.size() * 2);
+        cursor = sink.data() + used;
+        limit = sink.data() + sink.size();
+    }
+    
+    // Write out the remaining bits, zero-padded to a whole byte
+    void finish() {
+        while (count > 0) {
+            if (cursor == limit) grow();
+            int shift = count - 8;
+            *cursor++ = static_cast<uint8_t>(shift >= 0 ? acc >> shift : acc << -shift);
+            count -= 8;
+        }
+        count = 0;
+        sink.resize(cursor - sink.data());
+    }
+};
+
+// Decode exactly `n` symbols into `out`
+void decodeSymbols(const DecodeTable &table, BitReader &reader, uint8_t *out, size_t n) {
+    const DecodeEntry *entries = table.entries.data();
+    uint8_t *outEnd = out + n;
+    
+    // Fast path: every code fits the primary table, so four probes share one refill
+    if (table.maxLength <= DECODE_TABLE_BITS) {
+        while (outEnd - out >= 8) {
+            reader.refill();
+            for (int probe = 0; probe < 4; probe++) {
+                const DecodeEntry &e = entries[reader.peek(DECODE_TABLE_BITS)];
+                out[0] = static_cast<uint8_t>(e.value);
+                out[1] = static_cast<uint8_t>(e.value >> 8);
+                out += e.count;
+                reader.skip(e.bits);
+            }
+        }
+    }
+    
+    while (out < outEnd) {
+        reader.refill();
+        const DecodeEntry *e = &entries[reader.peek(DECODE_TABLE_BITS)];
+        if (e->count == 0) {
+            reader.skip(DECODE_TABLE_BITS);
+            while (e->count == 0) {
+                int subBits = e->bits;
+                e = &entries[e->value + reader.peek(subBits)];
+                if (e->count == 0) reader.skip(subBits);
+            }
+        }
+        *out++ = static_cast<uint8_t>(e->value);
+        if (e->count == 2 && out < outEnd) {
+            *out++ = static_cast<uint8_t>(e->value >> 8);
+            reader.skip(e->bits);
+        } else {
+            reader.skip(e->firstBits);
+        }
+    }
+}
+
+// Append an unsigned integer as a little-endian base-128 varint
+void writeVarint(vector<uint8_t> &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+// Read a varint written by writeVarint; false if the data ends first
+bool readVarint(const uint8_t *data, size_t size, size_t &pos, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < size; shift += 7) {
+        uint8_t byte = data[pos++];
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// Serialize code lengths for symbols 0-255: a byte below 0x80 is the length of the
+// next symbol, while 0x80 + n skips n + 1 unused symbols
+void writeCodeLengths(const uint8_t lengths[256], vector<uint8_t> &out) {
+    int s = 0;
+    while (s < 256) {
+        if (lengths[s]) {
+            out.push_back(lengths[s++]);
+            continue;
+        }
+        int run = 0;
+        while (s + run < 256 && !lengths[s + run] && run < 128) run++;
+        out.push_back(static_cast<uint8_t>(0x80 + run - 1));
+        s += run;
+    }
+}
+
+// Parse code lengths written by writeCodeLengths
+bool readCodeLengths(const uint8_t *data, size_t size, size_t &pos, uint8_t lengths[256]) {
+    int s = 0;
+    while (s < 256) {
+        if (pos >= size) return false;
+        uint8_t byte = data[pos++];
+        if (byte < 0x80) {
+            lengths[s++] = byte;
+        } else {
+            int run = byte - 0x80 + 1;
+            if (s + run > 256) return false;
+            memset(lengths + s, 0, run);
+            s += run;
+        }
+    }
+    return true;
+}
+
+// Little-endian fixed-width integer helpers for the block index
+void putU32(vector<uint8_t> &out, uint32_t value) {
+    for (int i = 0; i < 4; i++) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+void putU64(vector<uint8_t> &out, uint64_t value) {
+    for (int i = 0; i < 8; i++) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+uint32_t getU32(const uint8_t *p) {
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+uint64_t getU64(const uint8_t *p) {
+    return uint64_t(getU32(p)) | uint64_t(getU32(p + 4)) << 32;
+}
+
+// CRC32C (Castagnoli) lookup tables for slicing-by-8
+struct Crc32cTables {
+    uint32_t table[8][256];
+    
+    Crc32cTables() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+            table[0][i] = crc;
+        }
+        for (int t = 1; t < 8; t++) {
+            for (int i = 0; i < 256; i++) {
+                table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xFF];
+            }
+        }
+    }
+};
+
+// Slicing-by-8 CRC32C on an already inverted crc, eight bytes per step
+uint32_t crc32cPortable(const uint8_t *data, size_t size, uint32_t crc) {
+    static const Crc32cTables tables;
+    const auto &t = tables.table;
+    while (size >= 8) {
+        uint32_t lo = crc ^ getU32(data);
+        uint32_t hi = getU32(data + 4);
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        data += 8;
+        size -= 8;
+    }
+    while (size--) crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF];
+    return crc;
+}
+
+#ifdef CRC32C_RUNTIME_DISPATCH
+// The same with the SSE4.2 crc32 instruction; only called when the CPU reports it
+__attribute__((target("sse4.2")))
+uint32_t crc32cHardware(const uint8_t *data, size_t size, uint32_t crc) {
+    uint64_t wide = crc;
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        wide = _mm_crc32_u64(wide, word);
+        data += 8;
+        size -= 8;
+    }
+    crc = static_cast<uint32_t>(wide);
+    while (size--) crc = _mm_crc32_u8(crc, *data++);
+    return crc;
+}
+#endif
+
+// CRC32C of a buffer: with the crc32 instruction when the CPU has SSE4.2 (checked once),
+// otherwise with slicing-by-8 tables
+uint32_t crc32c(const uint8_t *data, size_t size, uint32_t crc = 0) {
+#ifdef CRC32C_RUNTIME_DISPATCH
+    static const bool hardware = __builtin_cpu_supports("sse4.2");
+    if (hardware) return ~crc32cHardware(data, size, ~crc);
+#endif
+    return ~crc32cPortable(data, size, ~crc);
+}
+
+// Multiply a 32x32 GF(2) matrix (one column per word) by a vector
+uint32_t gf2MatrixTimes(const uint32_t *matrix, uint32_t vec) {
+    uint32_t sum = 0;
+    for (; vec; vec >>= 1, matrix++) {
+        if (vec & 1) sum ^= *matrix;
+    }
+    return sum;
+}
+
+void gf2MatrixSquare(uint32_t *square, const uint32_t *matrix) {
+    for (int n = 0; n < 32; n++) square[n] = gf2MatrixTimes(matrix, matrix[n]);
+}
+
+// CRC32C of A followed by B, given crc32c(A), crc32c(B) and the length of B. This lets
+// blocks be checksummed independently and folded into a whole-file checksum in order.
+uint32_t crc32cCombine(uint32_t crcA, uint32_t crcB, uint64_t lengthB) {
+    if (lengthB == 0) return crcA;
+    
+    // Operator for one zero bit, then repeatedly squared to cover lengthB zero bytes
+    uint32_t even[32], odd[32];
+    odd[0] = 0x82F63B78u;
+    for (int n = 1; n < 32; n++) odd[n] = 1u << (n - 1);
+    gf2MatrixSquare(even, odd);
+    gf2MatrixSquare(odd, even);
+    do {
+        gf2MatrixSquare(even, odd);
+        if (lengthB & 1) crcA = gf2MatrixTimes(even, crcA);
+        lengthB >>= 1;
+        if (lengthB == 0) break;
+        gf2MatrixSquare(odd, even);
+        if (lengthB & 1) crcA = gf2MatrixTimes(odd, crcA);
+        lengthB >>= 1;
+    } while (lengthB);
+    return crcA ^ crcB;
+}
+
+// Container header: magic, format version, flags, then the dictionary ID if flagged
+const uint8_t FORMAT_MAGIC[4] = {'H', 'U', 'F', 'Z'};
+const uint8_t FORMAT_VERSION = 1;
+const size_t FORMAT_HEADER_SIZE = 6;
+const uint8_t FLAG_DICTIONARY = 1;   // Blocks were coded against a trained dictionary
+const uint8_t FLAG_SINGLE_BLOCK = 2; // At most one block and no index or footer
+
+// What the container header (and, once the index is read, the footer) says about a file
+struct ContainerInfo {
+    uint8_t flags = 0;
+    uint32_t dictionaryId = 0; // With FLAG_DICTIONARY
+    uint32_t checksum = 0;     // CRC32C of the whole original data
+};
+
+void appendContainerHeader(vector<uint8_t> &out, uint8_t flags, uint32_t dictionaryId) {
+    out.insert(out.end(), FORMAT_MAGIC, FORMAT_MAGIC + 4);
+    out.push_back(FORMAT_VERSION);
+    out.push_back(flags);
+    if (flags & FLAG_DICTIONARY) putU32(out, dictionaryId);
+}
+
+// Write the container header, returning its size
+size_t writeContainerHeader(ostream &out, uint8_t flags, uint32_t dictionaryId) {
+    vector<uint8_t> header;
+    appendContainerHeader(header, flags, dictionaryId);
+    out.write(reinterpret_cast<const char*>(header.data()), header.size());
+    return header.size();
+}
+
+// Check the container header; false for foreign data, an unsupported version or unknown flags
+bool readContainerHeader(istream &in, ContainerInfo &info) {
+    uint8_t header[FORMAT_HEADER_SIZE];
+    if (!in.read(reinterpret_cast<char*>(header), FORMAT_HEADER_SIZE) || memcmp(header, FORMAT_MAGIC, 4) != 0 ||
+        header[4] != FORMAT_VERSION || (header[5] & ~(FLAG_DICTIONARY | FLAG_SINGLE_BLOCK))) {
+        return false;
+    }
+    info = ContainerInfo();
+    info.flags = header[5];
+    if (info.flags & FLAG_DICTIONARY) {
+        uint8_t id[4];
+        if (!in.read(reinterpret_cast<char*>(id), sizeof(id))) return false;
+        info.dictionaryId = getU32(id);
+    }
+    return true;
+}
+
+} // namespace
+
+// Location and checksum of one block, as stored in the trailing block index
+struct BlockIndexEntry {
+    uint64_t offset;     // File offset of the block payload
+    uint32_t packedSize;
+    uint32_t rawSize;
+    uint32_t checksum;   // CRC32C of the raw block
+    uint64_t rawOffset;  // Position of the block in the original data (derived, not stored)
+};
+
+namespace {
+
+const size_t INDEX_ENTRY_SIZE = 20;
+const size_t INDEX_FOOTER_SIZE = 28;
+const uint32_t INDEX_MAGIC = 0x58444948; // "HIDX"
+
+// Append the block index and its fixed-size footer, which carries the total raw size
+// and the CRC32C of the whole original data
+void appendBlockIndex(vector<uint8_t> &bytes, const vector<BlockIndexEntry> &index, uint64_t indexOffset,
+                      uint64_t rawSize, uint32_t fileChecksum) {
+    for (const auto &entry : index) {
+        putU64(bytes, entry.offset);
+        putU32(bytes, entry.packedSize);
+        putU32(bytes, entry.rawSize);
+        putU32(bytes, entry.checksum);
+    }
+    putU64(bytes, indexOffset);
+    putU32(bytes, static_cast<uint32_t>(index.size()));
+    putU64(bytes, rawSize);
+    putU32(bytes, fileChecksum);
+    putU32(bytes, INDEX_MAGIC);
+}
+
+void writeBlockIndex(ostream &out, const vector<BlockIndexEntry> &index, uint64_t indexOffset,
+                     uint64_t rawSize, uint32_t fileChecksum) {
+    vector<uint8_t> bytes;
+    appendBlockIndex(bytes, index, indexOffset, rawSize, fileChecksum);
+    out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+// Read a varint from a stream; false at end of stream or on a truncated value
+bool readVarint(istream &in, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = in.get();
+        if (byte == EOF) return false;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// A single-block file has no index: its one block header (if any) stands in for it
+bool readSingleBlockIndex(istream &in, vector<BlockIndexEntry> &index, ContainerInfo &info) {
+    index.clear();
+    uint64_t rawSize = 0, packedSize = 0;
+    if (!readVarint(in, rawSize)) return false;
+    if (rawSize > 0) {
+        uint8_t stored[4];
+        if (!readVarint(in, packedSize) || rawSize > MAX_BLOCK_SIZE || packedSize > 2 * MAX_BLOCK_SIZE ||
+            !in.read(reinterpret_cast<char*>(stored), sizeof(stored))) {
+            return false;
+        }
+        uint64_t offset = static_cast<uint64_t>(in.tellg());
+        info.checksum = getU32(stored);
+        index.push_back({offset, static_cast<uint32_t>(packedSize), static_cast<uint32_t>(rawSize), info.checksum, 0});
+        in.seekg(offset + packedSize);
+        if (!readVarint(in, rawSize) || rawSize != 0) return false;
+    }
+    return in.peek() == EOF;
+}
+
+// Load the block index through the footer at the end of the file, after checking the
+// container header; `info` also receives the stored whole-file CRC32C
+bool readBlockIndex(istream &in, vector<BlockIndexEntry> &index, ContainerInfo &info) {
+    in.seekg(0);
+    if (!readContainerHeader(in, info)) return false;
+    if (info.flags & FLAG_SINGLE_BLOCK) return readSingleBlockIndex(in, index, info);
+    uint64_t headerSize = static_cast<uint64_t>(in.tellg());
+    in.seekg(0, ios::end);
+    uint64_t fileSize = static_cast<uint64_t>(in.tellg());
+    if (!in || fileSize < FORMAT_HEADER_SIZE + INDEX_FOOTER_SIZE) return false;
+    
+    uint8_t footer[INDEX_FOOTER_SIZE];
+    in.seekg(fileSize - INDEX_FOOTER_SIZE);
+    if (!in.read(reinterpret_cast<char*>(footer), INDEX_FOOTER_SIZE)) return false;
+    uint64_t indexOffset = getU64(footer);
+    uint32_t count = getU32(footer + 8);
+    uint64_t rawSize = getU64(footer + 12);
+    info.checksum = getU32(footer + 20);
+    // Compared by subtraction from known-good bounds, so a crafted footer cannot wrap
+    // around to a match and then ask for a huge index buffer
+    if (getU32(footer + 24) != INDEX_MAGIC || indexOffset < headerSize ||
+        indexOffset > fileSize - INDEX_FOOTER_SIZE ||
+        fileSize - INDEX_FOOTER_SIZE - indexOffset != uint64_t(count) * INDEX_ENTRY_SIZE) {
+        return false;
+    }
+    
+    vector<uint8_t> bytes(size_t(count) * INDEX_ENTRY_SIZE);
+    in.seekg(indexOffset);
+    if (!in.read(reinterpret_cast<char*>(bytes.data()), bytes.size())) return false;
+    
+    index.clear();
+    uint64_t rawOffset = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t *p = bytes.data() + i * INDEX_ENTRY_SIZE;
+        BlockIndexEntry entry = {getU64(p), getU32(p + 8), getU32(p + 12), getU32(p + 16), rawOffset};
+        if (entry.rawSize > MAX_BLOCK_SIZE || entry.offset > indexOffset ||
+            entry.packedSize > indexOffset - entry.offset) {
+            return false;
+        }
+        rawOffset += entry.rawSize;
+        index.push_back(entry);
+    }
+    return rawOffset == rawSize;
+}
+
+// Count byte frequencies into a flat 256-entry histogram. Four interleaved tables keep
+// runs of equal bytes from serializing on a single counter's store-to-load latency.
+void calculateFrequencies(const uint8_t *data, size_t size, uint32_t freq[256]) {
+    uint32_t tables[4][256] = {{0}};
+    size_t i = 0;
+    
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        tables[0][word & 0xFF]++;
+        tables[1][(word >> 8) & 0xFF]++;
+        tables[2][(word >> 16) & 0xFF]++;
+        tables[3][(word >> 24) & 0xFF]++;
+        tables[0][(word >> 32) & 0xFF]++;
+        tables[1][(word >> 40) & 0xFF]++;
+        tables[2][(word >> 48) & 0xFF]++;
+        tables[3][word >> 56]++;
+    }
+    for (; i < size; i++) tables[0][data[i]]++;
+    
+    for (int s = 0; s < 256; s++) {
+        freq[s] = tables[0][s] + tables[1][s] + tables[2][s] + tables[3][s];
+    }
+}
+
+// Huffman-code a byte sequence whose histogram is already known
+void encodeHuffman(const uint8_t *data, size_t size, const uint32_t freq[256], vector<uint8_t> &out,
+                   int maxCodeLength) {
+    // Step 1: Compute length-limited code lengths
+    uint8_t lengths[256];
+    computeCodeLengths(freq, lengths, maxCodeLength);
+    
+    // Step 2: Generate Huffman codes
+    HuffmanCodeTable table;
+    generateHuffmanCodes(lengths, table);
+    
+    // Step 3: Write code lengths and encoded symbols
+    writeCodeLengths(lengths, out);
+    uint64_t bits = 0;
+    for (int s = 0; s < 256; s++) bits += uint64_t(freq[s]) * lengths[s];
+    BitWriter writer(out, static_cast<size_t>((bits + 7) / 8));
+    for (size_t i = 0; i < size; i++) {
+        writer.put(table.code[data[i]], table.length[data[i]]);
+    }
+    writer.finish();
+}
+
+// Huffman-code a byte sequence: its code lengths followed by the bit-packed symbols
+void encodeHuffman(const uint8_t *data, size_t size, vector<uint8_t> &out,
+                   int maxCodeLength = DEFAULT_CODE_LENGTH_LIMIT) {
+    uint32_t freq[256];
+    calculateFrequencies(data, size, freq);
+    encodeHuffman(data, size, freq, out, maxCodeLength);
+}
+
+// Decode `rawSize` bytes written by encodeHuffman
+bool decodeHuffman(const uint8_t *data, size_t size, uint8_t *out, size_t rawSize) {
+    size_t pos = 0;
+    uint8_t lengths[256] = {0};
+    DecodeTable table;
+    if (!readCodeLengths(data, size, pos, lengths) || !buildDecodeTable(lengths, table)) {
+        return false;
+    }
+    BitReader reader(data + pos, size - pos);
+    decodeSymbols(table, reader, out, rawSize);
+    return true;
+}
+
+// Bytes encodeHuffman would produce for a histogram, without encoding anything
+size_t huffmanCost(const uint32_t freq[256], int maxCodeLength) {
+    uint8_t lengths[256];
+    computeCodeLengths(freq, lengths, maxCodeLength);
+    uint64_t bits = 0;
+    for (int s = 0; s < 256; s++) bits += uint64_t(freq[s]) * lengths[s];
+    vector<uint8_t> header;
+    writeCodeLengths(lengths, header);
+    return header.size() + static_cast<size_t>((bits + 7) / 8);
+}
+
+} // namespace
+
+// A code table agreed on in advance (trained into a dictionary), so no code lengths
+// travel with the data it codes
+struct SharedCodeTable {
+    uint8_t lengths[256];
+    HuffmanCodeTable codes;
+    DecodeTable decode;
+};
+
+namespace {
+
+// Bytes a shared table spends on a histogram, or SIZE_MAX if it has no code for a used symbol
+size_t sharedCost(const uint32_t freq[256], const SharedCodeTable &table) {
+    uint64_t bits = 0;
+    for (int s = 0; s < 256; s++) {
+        if (freq[s] && !table.lengths[s]) return SIZE_MAX;
+        bits += uint64_t(freq[s]) * table.lengths[s];
+    }
+    return static_cast<size_t>((bits + 7) / 8);
+}
+
+// Code a byte sequence with a shared table: the bit-packed symbols only. `codedSize` is
+// what sharedCost reported, so the output is sized once.
+void encodeShared(const uint8_t *data, size_t size, const SharedCodeTable &table, vector<uint8_t> &out,
+                  size_t codedSize) {
+    BitWriter writer(out, codedSize);
+    for (size_t i = 0; i < size; i++) {
+        writer.put(table.codes.code[data[i]], table.codes.length[data[i]]);
+    }
+    writer.finish();
+}
+
+bool decodeShared(const uint8_t *data, size_t size, const SharedCodeTable &table, uint8_t *out, size_t rawSize) {
+    BitReader reader(data, size);
+    decodeSymbols(table.decode, reader, out, rawSize);
+    return true;
+}
+
+// Length-prefixed Huffman stream, so several can follow each other in one block. When
+// a shared table is offered, the low bit of the prefix says whether the stream uses it
+// instead of carrying its own code lengths.
+void writeHuffmanStream(const uint8_t *data, size_t size, vector<uint8_t> &out, int maxCodeLength,
+                        const SharedCodeTable *shared = nullptr) {
+    if (size == 0) {
+        writeVarint(out, 0);
+        return;
+    }
+    uint32_t freq[256];
+    calculateFrequencies(data, size, freq);
+    // Both costs are exact, so the length prefix goes out first and the stream is coded
+    // directly behind it
+    size_t ownSize = huffmanCost(freq, maxCodeLength);
+    size_t sharedSize = shared ? sharedCost(freq, *shared) : SIZE_MAX;
+    bool useShared = sharedSize <= ownSize;
+    size_t bodySize = useShared ? sharedSize : ownSize;
+    writeVarint(out, shared ? bodySize << 1 | useShared : bodySize);
+    if (useShared) {
+        encodeShared(data, size, *shared, out, sharedSize);
+    } else {
+        encodeHuffman(data, size, freq, out, maxCodeLength);
+    }
+}
+
+bool readHuffmanStream(const uint8_t *data, size_t size, size_t &pos, uint8_t *out, size_t rawSize,
+                       const SharedCodeTable *shared = nullptr) {
+    uint64_t bodySize = 0;
+    if (!readVarint(data, size, pos, bodySize)) return false;
+    bool useShared = shared && (bodySize & 1);
+    if (shared) bodySize >>= 1;
+    if (bodySize > size - pos) return false;
+    if (rawSize == 0) return bodySize == 0 && !useShared;
+    bool ok = useShared ? decodeShared(data + pos, static_cast<size_t>(bodySize), *shared, out, rawSize)
+                        : decodeHuffman(data + pos, static_cast<size_t>(bodySize), out, rawSize);
+    pos += static_cast<size_t>(bodySize);
+    return ok;
+}
+
+// Shared tables in a dictionary: one per LZ77 stream, plus one for whole-block Huffman
+const int SHARED_LITERALS = 0;
+const int SHARED_LITERAL_LENGTHS = 1;
+const int SHARED_MATCH_LENGTHS = 2;
+const int SHARED_OFFSETS = 3;
+const int SHARED_BYTES = 4;
+const int SHARED_TABLE_COUNT = 5;
+
+} // namespace
+
+// LZ77 hash-chain state over a fixed history, built once so blocks that match against
+// it copy the head table instead of re-inserting every history position
+struct LzHistory {
+    vector<int32_t> head; // Most recent history position per hash (LZ_HASH_BITS wide)
+    vector<int32_t> prev; // Chain links of the positions inserted, read in place
+};
+
+// Trained from samples of small, similar inputs: shared code tables, so tiny blocks do
+// not pay for their own, and LZ77 history that every block may copy from
+struct Dictionary {
+    uint32_t id = 0;         // CRC32C of the dictionary file, recorded in compressed files
+    SharedCodeTable tables[SHARED_TABLE_COUNT];
+    vector<uint8_t> content; // Placed before each block as match history
+    LzHistory chains;        // Hash chains over `content`
+};
+
+const int MIN_MATCH = 4;        // Shortest match worth a sequence
+const int LZ_HASH_BITS = 16;    // Hash-chain head table size
+const size_t MIN_MATCH_FAR = 4096; // Minimum-length matches farther back cost more than their literals
+const int DEFAULT_LEVEL = 3;
+const int DEFAULT_WINDOW_BITS = 20;
+
+// Tuning knobs shared by the compressor entry points
+struct CompressionOptions {
+    unsigned threads = max(thread::hardware_concurrency(), 1u);
+    size_t blockSize = DEFAULT_BLOCK_SIZE;
+    int level = DEFAULT_LEVEL;            // 0 = Huffman only, 1-9 = LZ77 with deeper searches
+    int windowBits = DEFAULT_WINDOW_BITS; // LZ77 window is 2^windowBits bytes (within a block)
+    int maxCodeLength = DEFAULT_CODE_LENGTH_LIMIT; // Huffman code length cap, 0 = unlimited
+    const Dictionary *dictionary = nullptr;        // Trained tables and history, if any
+    bool contextModel = false;            // Also try order-1 rANS on each block (slower, denser)
+    size_t memoryLimit = 0;               // Peak RSS ceiling in bytes, 0 = none (see fitMemoryLimit)
+};
+
+namespace {
+
+// Match finder effort for a compression level
+struct MatchParams {
+    int chainDepth;  // Hash-chain candidates examined per position
+    int niceLength;  // Stop searching once a match is this long
+    bool lazy;       // Try one position later before committing to a match
+    int skipShift;   // When nonzero, stride grows by 1 every 2^skipShift misses in a row
+};
+
+MatchParams matchParamsForLevel(int level) {
+    static const MatchParams params[10] = {
+        {0, 0, false, 0},    {2, 16, false, 0},   {4, 32, false, 0},    {8, 64, false, 0},
+        {16, 64, true, 0},   {32, 128, true, 0},  {64, 128, true, 0},   {128, 256, true, 0},
+        {256, 512, true, 0}, {512, 1024, true, 0},
+    };
+    return params[max(0, min(level, 9))];
+}
+
+// One LZ77 step: copy `literalLength` literals, then `matchLength` bytes from `offset` back
+struct LzSequence {
+    uint32_t literalLength;
+    uint32_t matchLength;
+    uint32_t offset;
+};
+
+uint32_t readU32Native(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+uint32_t lzHash(const uint8_t *p, int hashBits) {
+    return (readU32Native(p) * 2654435761u) >> (32 - hashBits);
+}
+
+// Number of equal bytes at `a` and `b`, up to `limit`
+size_t commonLength(const uint8_t *a, const uint8_t *b, size_t limit) {
+    size_t n = 0;
+    while (n + 8 <= limit) {
+        uint64_t x, y;
+        memcpy(&x, a + n, 8);
+        memcpy(&y, b + n, 8);
+        if (x != y) break;
+        n += 8;
+    }
+    while (n < limit && a[n] == b[n]) n++;
+    return n;
+}
+
+// Hash-chain LZ77 parse of one block into sequences plus the literal bytes they copy.
+// The first `start` bytes are history (a dictionary): matches may reach into them, but
+// they are not coded. When `chains` covers that history, its chains are reused rather
+// than rebuilt. Small inputs get a smaller hash table.
+void findSequences(const uint8_t *data, size_t size, const MatchParams &params, int windowBits,
+                   vector<LzSequence> &sequences, vector<uint8_t> &literals, size_t start = 0,
+                   const LzHistory *chains = nullptr) {
+    size_t window = size_t(1) << windowBits;
+    int hashBits = LZ_HASH_BITS;
+    while (!chains && hashBits > 10 && (size_t(1) << (hashBits - 2)) >= size) hashBits--;
+    size_t linked = chains ? chains->prev.size() : 0; // Positions whose links live in `chains`
+    vector<int32_t> head = chains ? chains->head : vector<int32_t>(size_t(1) << hashBits, -1);
+    vector<int32_t> prev(size - linked);
+    
+    auto hashAt = [&](size_t pos) { return lzHash(data + pos, hashBits); };
+    auto insert = [&](size_t pos) {
+        uint32_t h = hashAt(pos);
+        prev[pos - linked] = head[h];
+        head[h] = static_cast<int32_t>(pos);
+    };
+    auto longestMatch = [&](size_t pos, uint32_t &offset) {
+        size_t best = MIN_MATCH - 1;
+        size_t limit = size - pos;
+        int32_t candidate = head[hashAt(pos)];
+        for (int depth = params.chainDepth; candidate >= 0 && depth > 0; depth--) {
+            size_t distance = pos - candidate;
+            if (distance > window) break;
+            if (data[candidate + best] == data[pos + best] || best >= limit) {
+                size_t length = commonLength(data + candidate, data + pos, limit);
+                if (length > best) {
+                    best = length;
+                    offset = static_cast<uint32_t>(distance);
+                    if (length >= static_cast<size_t>(params.niceLength) || length == limit) break;
+                }
+            }
+            candidate = static_cast<size_t>(candidate) < linked ? chains->prev[candidate] : prev[candidate - linked];
+        }
+        return best;
+    };
+    
+    for (size_t p = linked; p < start && p + MIN_MATCH <= size; p++) insert(p);
+    size_t pos = start, anchor = start, misses = 0;
+    while (pos + MIN_MATCH <= size) {
+        uint32_t offset = 0;
+        size_t length = longestMatch(pos, offset);
+        insert(pos);
+        if (length < static_cast<size_t>(MIN_MATCH) || (length == MIN_MATCH && offset > MIN_MATCH_FAR)) {
+            pos += params.skipShift ? 1 + (misses++ >> params.skipShift) : 1;
+            continue;
+        }
+        misses = 0;
+        
+        // Lazy evaluation: take a literal if the next position starts a longer match
+        while (params.lazy && length < static_cast<size_t>(params.niceLength) && pos + 1 + MIN_MATCH <= size) {
+            uint32_t nextOffset = 0;
+            size_t nextLength = longestMatch(pos + 1, nextOffset);
+            if (nextLength <= length) break;
+            insert(++pos);
+            length = nextLength;
+            offset = nextOffset;
+        }
+        
+        sequences.push_back({static_cast<uint32_t>(pos - anchor), static_cast<uint32_t>(length), offset});
+        literals.insert(literals.end(), data + anchor, data + pos);
+        for (size_t p = pos + 1; p < pos + length && p + MIN_MATCH <= size; p++) insert(p);
+        pos += length;
+        anchor = pos;
+    }
+    literals.insert(literals.end(), data + anchor, data + size);
+}
+
+// Hash chains over every position of `content` whose match window lies inside it; the
+// last MIN_MATCH - 1 positions reach into whatever follows and are left to each block
+void buildLzHistory(const vector<uint8_t> &content, LzHistory &chains) {
+    size_t count = content.size() >= MIN_MATCH ? content.size() - (MIN_MATCH - 1) : 0;
+    chains.head.assign(size_t(1) << LZ_HASH_BITS, -1);
+    chains.prev.resize(count);
+    for (size_t p = 0; p < count; p++) {
+        uint32_t h = lzHash(content.data() + p, LZ_HASH_BITS);
+        chains.prev[p] = chains.head[h];
+        chains.head[h] = static_cast<int32_t>(p);
+    }
+}
+
+// Split a value into a byte-sized code plus extra bits: values below 16 are their own
+// code, larger ones keep their top three bits in the code and the rest as extra bits
+void encodeValue(uint32_t value, uint8_t &code, uint32_t &extra, int &extraBits) {
+    if (value < 16) {
+        code = static_cast<uint8_t>(value);
+        extraBits = 0;
+        extra = 0;
+        return;
+    }
+    int top = 31;
+    while (!(value >> top)) top--;
+    code = static_cast<uint8_t>(16 + (top - 4) * 4 + ((value >> (top - 2)) & 3));
+    extraBits = top - 2;
+    extra = value & ((uint32_t(1) << extraBits) - 1);
+}
+
+// Inverse of encodeValue; false for codes no value maps to
+bool decodeValue(uint8_t code, BitReader &reader, uint32_t &value) {
+    if (code < 16) {
+        value = code;
+        return true;
+    }
+    if (code >= 16 + 28 * 4) return false;
+    int top = (code - 16) / 4 + 4;
+    int extraBits = top - 2;
+    reader.refill();
+    uint32_t extra = reader.peek(extraBits);
+    reader.skip(extraBits);
+    value = ((4u | ((code - 16) & 3)) << extraBits) | extra;
+    return true;
+}
+
+// Block coding methods, stored in the first payload byte
+const uint8_t METHOD_HUFFMAN = 0; // Order-0 Huffman over the raw bytes
+const uint8_t METHOD_LZ = 1;      // LZ77 sequences with Huffman-coded literals and codes
+const uint8_t METHOD_STORED = 2;  // Raw bytes, for incompressible data
+const uint8_t METHOD_RLE = 3;     // (byte, run length - 1 varint) pairs
+const uint8_t METHOD_SINGLE = 4;  // One byte value repeated for the whole block
+const uint8_t METHOD_HUFFMAN_SHARED = 5; // Order-0 Huffman with the dictionary's byte table
+const uint8_t METHOD_LZ_DICT = 6;  // LZ77 over the dictionary content, streams may use shared tables
+const uint8_t METHOD_RANS_O1 = 7;  // Order-1 context-modeled rANS over the raw bytes
+
+// LZ77 payload: counts, then Huffman streams for literals, literal-length codes,
+// match-length codes and offset codes, then the raw extra bits. With a dictionary,
+// matches may start in its content and each stream may use its shared table.
+void encodeLz(const uint8_t *data, size_t size, const MatchParams &params, const CompressionOptions &options,
+              vector<uint8_t> &out) {
+    vector<LzSequence> sequences;
+    vector<uint8_t> literals;
+    const Dictionary *dictionary = options.dictionary;
+    if (dictionary && !dictionary->content.empty()) {
+        vector<uint8_t> history(dictionary->content);
+        history.insert(history.end(), data, data + size);
+        findSequences(history.data(), history.size(), params, options.windowBits, sequences, literals,
+                      dictionary->content.size(), &dictionary->chains);
+    } else {
+        findSequences(data, size, params, options.windowBits, sequences, literals);
+    }
+    
+    vector<uint8_t> literalCodes, matchCodes, offsetCodes, extraBytes;
+    literalCodes.reserve(sequences.size());
+    matchCodes.reserve(sequences.size());
+    offsetCodes.reserve(sequences.size());
+    {
+        BitWriter extras(extraBytes);
+        uint8_t code;
+        uint32_t extra;
+        int extraBits;
+        for (const auto &seq : sequences) {
+            encodeValue(seq.literalLength, code, extra, extraBits);
+            literalCodes.push_back(code);
+            extras.put(extra, extraBits);
+            encodeValue(seq.matchLength - MIN_MATCH, code, extra, extraBits);
+            matchCodes.push_back(code);
+            extras.put(extra, extraBits);
+            encodeValue(seq.offset - 1, code, extra, extraBits);
+            offsetCodes.push_back(code);
+            extras.put(extra, extraBits);
+        }
+        extras.finish();
+    }
+    
+    writeVarint(out, literals.size());
+    writeVarint(out, sequences.size());
+    const SharedCodeTable *shared = dictionary ? dictionary->tables : nullptr;
+    writeHuffmanStream(literals.data(), literals.size(), out, options.maxCodeLength,
+                       shared ? &shared[SHARED_LITERALS] : nullptr);
+    writeHuffmanStream(literalCodes.data(), literalCodes.size(), out, options.maxCodeLength,
+                       shared ? &shared[SHARED_LITERAL_LENGTHS] : nullptr);
+    writeHuffmanStream(matchCodes.data(), matchCodes.size(), out, options.maxCodeLength,
+                       shared ? &shared[SHARED_MATCH_LENGTHS] : nullptr);
+    writeHuffmanStream(offsetCodes.data(), offsetCodes.size(), out, options.maxCodeLength,
+                       shared ? &shared[SHARED_OFFSETS] : nullptr);
+    out.insert(out.end(), extraBytes.begin(), extraBytes.end());
+}
+
+// Rebuild a block from an LZ77 payload, checking every copy against the block bounds.
+// With a dictionary, `out` must be preceded by the dictionary content.
+bool decodeLz(const uint8_t *data, size_t size, uint8_t *out, size_t rawSize,
+              const Dictionary *dictionary = nullptr) {
+    size_t pos = 0;
+    uint64_t literalCount = 0, sequenceCount = 0;
+    if (!readVarint(data, size, pos, literalCount) || !readVarint(data, size, pos, sequenceCount) ||
+        literalCount > rawSize || sequenceCount > rawSize / MIN_MATCH) {
+        return false;
+    }
+    
+    vector<uint8_t> literals(literalCount), literalCodes(sequenceCount),
+                    matchCodes(sequenceCount), offsetCodes(sequenceCount);
+    const SharedCodeTable *shared = dictionary ? dictionary->tables : nullptr;
+    if (!readHuffmanStream(data, size, pos, literals.data(), literals.size(),
+                           shared ? &shared[SHARED_LITERALS] : nullptr) ||
+        !readHuffmanStream(data, size, pos, literalCodes.data(), literalCodes.size(),
+                           shared ? &shared[SHARED_LITERAL_LENGTHS] : nullptr) ||
+        !readHuffmanStream(data, size, pos, matchCodes.data(), matchCodes.size(),
+                           shared ? &shared[SHARED_MATCH_LENGTHS] : nullptr) ||
+        !readHuffmanStream(data, size, pos, offsetCodes.data(), offsetCodes.size(),
+                           shared ? &shared[SHARED_OFFSETS] : nullptr)) {
+        return false;
+    }
+    size_t historySize = dictionary ? dictionary->content.size() : 0;
+    
+    BitReader extras(data + pos, size - pos);
+    const uint8_t *literal = literals.data();
+    const uint8_t *literalEnd = literal + literals.size();
+    uint8_t *dst = out;
+    uint8_t *dstEnd = out + rawSize;
+    for (size_t i = 0; i < sequenceCount; i++) {
+        uint32_t literalLength, matchLength, offset;
+        if (!decodeValue(literalCodes[i], extras, literalLength) ||
+            !decodeValue(matchCodes[i], extras, matchLength) ||
+            !decodeValue(offsetCodes[i], extras, offset)) {
+            return false;
+        }
+        matchLength += MIN_MATCH;
+        offset += 1;
+        if (literalLength > static_cast<size_t>(literalEnd - literal) ||
+            literalLength + size_t(matchLength) > static_cast<size_t>(dstEnd - dst) ||
+            offset > static_cast<size_t>(dst - out) + literalLength + historySize) {
+            return false;
+        }
+        
+        memcpy(dst, literal, literalLength);
+        dst += literalLength;
+        literal += literalLength;
+        
+        const uint8_t *src = dst - offset;
+        if (offset >= matchLength) {
+            memcpy(dst, src, matchLength);
+        } else {
+            for (uint32_t k = 0; k < matchLength; k++) dst[k] = src[k];
+        }
+        dst += matchLength;
+    }
+    
+    size_t trailing = literalEnd - literal;
+    if (trailing != static_cast<size_t>(dstEnd - dst)) return false;
+    memcpy(dst, literal, trailing);
+    return true;
+}
+
+// Number of runs of equal bytes
+size_t countRuns(const uint8_t *data, size_t size) {
+    size_t runs = size ? 1 : 0;
+    for (size_t i = 1; i < size; i++) runs += data[i] != data[i - 1];
+    return runs;
+}
+
+// Run-length payload: each run as its byte value and its length minus one
+void encodeRle(const uint8_t *data, size_t size, vector<uint8_t> &out) {
+    size_t i = 0;
+    while (i < size) {
+        size_t run = 1;
+        while (i + run < size && data[i + run] == data[i]) run++;
+        out.push_back(data[i]);
+        writeVarint(out, run - 1);
+        i += run;
+    }
+}
+
+bool decodeRle(const uint8_t *data, size_t size, uint8_t *out, size_t rawSize) {
+    size_t pos = 0, produced = 0;
+    while (pos < size) {
+        uint8_t value = data[pos++];
+        uint64_t run = 0;
+        if (!readVarint(data, size, pos, run) || run >= rawSize - produced) return false;
+        memset(out + produced, value, static_cast<size_t>(run) + 1);
+        produced += static_cast<size_t>(run) + 1;
+    }
+    return produced == rawSize;
+}
+
+// Order-1 rANS: each byte is coded with a frequency table selected by the byte before
+// it. Probabilities are scaled to 2^RANS_PRECISION (10 bits keeps all 256 contexts'
+// decode tables around 512 KB); the 32-bit states are renormalized a byte at a time.
+const int RANS_PRECISION = 10;
+const uint32_t RANS_TOTAL = 1u << RANS_PRECISION;
+const uint32_t RANS_LOWER = 1u << 23; // States stay in [RANS_LOWER, RANS_LOWER << 8)
+const int RANS_LANES = 4;             // Independent states, one per quarter of the block
+
+// Scale a context's counts to sum to RANS_TOTAL, keeping every seen symbol codable
+void normalizeFrequencies(const uint32_t counts[256], uint16_t freq[256]) {
+    uint64_t total = 0;
+    for (int s = 0; s < 256; s++) total += counts[s];
+    uint32_t sum = 0;
+    int largest = 0;
+    for (int s = 0; s < 256; s++) {
+        freq[s] = counts[s] ? static_cast<uint16_t>(max<uint64_t>(1, uint64_t(counts[s]) * RANS_TOTAL / total)) : 0;
+        sum += freq[s];
+        if (freq[s] > freq[largest]) largest = s;
+    }
+    if (sum <= RANS_TOTAL) {
+        freq[largest] += static_cast<uint16_t>(RANS_TOTAL - sum);
+        return;
+    }
+    // Rounding rare symbols up to 1 overshot: take the excess from the most frequent
+    while (sum > RANS_TOTAL) {
+        largest = 0;
+        for (int s = 1; s < 256; s++) {
+            if (freq[s] > freq[largest]) largest = s;
+        }
+        uint32_t take = min(sum - RANS_TOTAL, freq[largest] / 2u);
+        freq[largest] -= static_cast<uint16_t>(take);
+        sum -= take;
+    }
+}
+
+// Frequency tables: a bitmap of the contexts in use, then per context a varint token for
+// each symbol, either (frequency << 1) or ((run of absent symbols - 1) << 1 | 1)
+void writeRansTables(const vector<uint16_t> &freq, const bool used[256], vector<uint8_t> &out) {
+    for (int c = 0; c < 256; c += 8) {
+        uint8_t bits = 0;
+        for (int k = 0; k < 8; k++) bits |= static_cast<uint8_t>(used[c + k]) << k;
+        out.push_back(bits);
+    }
+    for (int c = 0; c < 256; c++) {
+        if (!used[c]) continue;
+        const uint16_t *f = &freq[c * 256];
+        int s = 0;
+        while (s < 256) {
+            if (f[s]) {
+                writeVarint(out, uint64_t(f[s]) << 1);
+                s++;
+                continue;
+            }
+            int run = 0;
+            while (s + run < 256 && !f[s + run]) run++;
+            writeVarint(out, uint64_t(run - 1) << 1 | 1);
+            s += run;
+        }
+    }
+}
+
+// Order-1 rANS payload: frequency tables, then the interleaved rANS stream. The block
+// is split into RANS_LANES parts (the last takes the remainder), each with its own
+// state and context chain, so a decoder can advance all lanes in parallel.
+void encodeRansO1(const uint8_t *data, size_t size, vector<uint8_t> &out) {
+    size_t quarter = size / RANS_LANES;
+    size_t lastLength = size - quarter * (RANS_LANES - 1);
+    auto laneStart = [&](int k) { return data + k * quarter; };
+    
+    vector<uint32_t> counts(256 * 256, 0);
+    bool used[256] = {false};
+    for (int k = 0; k < RANS_LANES; k++) {
+        size_t length = k == RANS_LANES - 1 ? lastLength : quarter;
+        uint8_t context = 0;
+        for (size_t i = 0; i < length; i++) {
+            counts[context * 256 + laneStart(k)[i]]++;
+            used[context] = true;
+            context = laneStart(k)[i];
+        }
+    }
+    vector<uint16_t> freq(256 * 256, 0), start(256 * 256, 0);
+    for (int c = 0; c < 256; c++) {
+        if (!used[c]) continue;
+        normalizeFrequencies(&counts[c * 256], &freq[c * 256]);
+        for (int s = 1; s < 256; s++) start[c * 256 + s] = start[c * 256 + s - 1] + freq[c * 256 + s - 1];
+    }
+    writeRansTables(freq, used, out);
+    
+    // rANS runs backwards: symbols are encoded in the reverse of decoding order, and the
+    // output grows down from the end of the buffer
+    vector<uint8_t> buffer(size * 2 + 16 * RANS_LANES);
+    uint8_t *ptr = buffer.data() + buffer.size();
+    uint32_t state[RANS_LANES];
+    for (auto &x : state) x = RANS_LOWER;
+    auto encode = [&](uint32_t &x, uint8_t context, uint8_t symbol) {
+        uint32_t f = freq[context * 256 + symbol];
+        uint32_t limit = ((RANS_LOWER >> RANS_PRECISION) << 8) * f;
+        while (x >= limit) {
+            *--ptr = static_cast<uint8_t>(x);
+            x >>= 8;
+        }
+        x = ((x / f) << RANS_PRECISION) + (x % f) + start[context * 256 + symbol];
+    };
+    
+    const uint8_t *last = laneStart(RANS_LANES - 1);
+    for (size_t i = lastLength; i-- > quarter;) encode(state[RANS_LANES - 1], i ? last[i - 1] : 0, last[i]);
+    for (size_t i = quarter; i-- > 0;) {
+        for (int k = RANS_LANES - 1; k >= 0; k--) {
+            encode(state[k], i ? laneStart(k)[i - 1] : 0, laneStart(k)[i]);
+        }
+    }
+    for (int k = RANS_LANES - 1; k >= 0; k--) {
+        for (int shift = 24; shift >= 0; shift -= 8) *--ptr = static_cast<uint8_t>(state[k] >> shift);
+    }
+    out.insert(out.end(), ptr, buffer.data() + buffer.size());
+}
+
+// Decoder table for one context: the symbol owning each of the RANS_TOTAL slots, and
+// each symbol's frequency (low half) and first slot (high half)
+struct RansContext {
+    uint32_t range[256];
+    uint8_t symbol[RANS_TOTAL];
+};
+
+bool decodeRansO1(const uint8_t *data, size_t size, uint8_t *out, size_t rawSize) {
+    size_t pos = 32;
+    if (size < pos) return false;
+    
+    // Contexts absent from the tables never occur in valid data; corrupt data that
+    // reaches one decodes harmlessly through a placeholder and fails the checksum
+    vector<RansContext> context(256);
+    for (int c = 0; c < 256; c++) {
+        RansContext &t = context[c];
+        if (!(data[c / 8] >> (c % 8) & 1)) {
+            t.range[0] = RANS_TOTAL;
+            continue;
+        }
+        uint32_t total = 0;
+        int s = 0;
+        while (s < 256) {
+            uint64_t token = 0;
+            if (!readVarint(data, size, pos, token)) return false;
+            if (token & 1) {
+                uint64_t run = (token >> 1) + 1;
+                if (run > uint64_t(256 - s)) return false;
+                s += static_cast<int>(run);
+                continue;
+            }
+            uint64_t f = token >> 1;
+            if (f == 0 || f > RANS_TOTAL - total) return false;
+            t.range[s] = static_cast<uint32_t>(f) | total << 16;
+            memset(t.symbol + total, s, static_cast<size_t>(f));
+            total += static_cast<uint32_t>(f);
+            s++;
+        }
+        if (total != RANS_TOTAL) return false;
+    }
+    
+    const uint8_t *ptr = data + pos;
+    const uint8_t *end = data + size;
+    if (end - ptr < 4 * RANS_LANES) return false;
+    uint32_t state[RANS_LANES];
+    for (auto &x : state) {
+        x = getU32(ptr);
+        ptr += 4;
+    }
+    
+    // One decode step. Renormalization reads at most two bytes per step, so while enough
+    // input remains it runs branch-free and unchecked.
+    const RansContext *tables = context.data();
+    auto step = [&](uint32_t &x, uint8_t &ctx, uint8_t *dst) {
+        const RansContext &t = tables[ctx];
+        uint32_t slot = x & (RANS_TOTAL - 1);
+        uint8_t s = t.symbol[slot];
+        uint32_t range = t.range[s];
+        x = (range & 0xFFFF) * (x >> RANS_PRECISION) + slot - (range >> 16);
+        *dst = ctx = s;
+    };
+    auto refill = [&](uint32_t &x) {
+        for (int k = 0; k < 2; k++) {
+            bool low = x < RANS_LOWER;
+            uint32_t shifted = (x << 8) | *ptr;
+            x = low ? shifted : x;
+            ptr += low;
+        }
+    };
+    auto refillChecked = [&](uint32_t &x) {
+        while (x < RANS_LOWER) x = (x << 8) | (ptr < end ? *ptr++ : 0);
+    };
+    
+    size_t quarter = rawSize / RANS_LANES;
+    uint8_t ctx[RANS_LANES] = {0};
+    uint8_t *lane[RANS_LANES];
+    for (int k = 0; k < RANS_LANES; k++) lane[k] = out + k * quarter;
+    size_t i = 0;
+    for (; i < quarter && end - ptr >= 2 * RANS_LANES; i++) {
+        for (int k = 0; k < RANS_LANES; k++) step(state[k], ctx[k], lane[k] + i);
+        for (int k = 0; k < RANS_LANES; k++) refill(state[k]);
+    }
+    for (; i < quarter; i++) {
+        for (int k = 0; k < RANS_LANES; k++) {
+            step(state[k], ctx[k], lane[k] + i);
+            refillChecked(state[k]);
+        }
+    }
+    uint32_t &x = state[RANS_LANES - 1];
+    for (size_t j = quarter; j < rawSize - quarter * (RANS_LANES - 1); j++) {
+        step(x, ctx[RANS_LANES - 1], lane[RANS_LANES - 1] + j);
+        refillChecked(x);
+    }
+    
+    // A well-formed stream ends exactly where the encoder started
+    for (uint32_t finalState : state) {
+        if (finalState != RANS_LOWER) return false;
+    }
+    return ptr == end;
+}
+
+// Compress one block: a method byte followed by the method's payload. The method is
+// chosen from the histogram and run count, so repetitive blocks never reach the
+// entropy coders, and blocks with near-random byte statistics only get a fast
+// accelerating LZ77 probe (which still catches long repeats) before being stored.
+void compressBlockOrder0(const uint8_t *data, size_t size, const CompressionOptions &options, vector<uint8_t> &out) {
+    size_t start = out.size();
+    uint32_t freq[256];
+    calculateFrequencies(data, size, freq);
+    
+    if (size > 0 && freq[data[0]] == size) {
+        out.push_back(METHOD_SINGLE);
+        out.push_back(data[0]);
+        return;
+    }
+    
+    // Estimated payload of each whole-block method (RLE: byte plus 1-3 varint bytes per run)
+    size_t runs = countRuns(data, size);
+    size_t rleCost = runs * 2 + runs / 8;
+    size_t huffCost = huffmanCost(freq, options.maxCodeLength);
+    const Dictionary *dictionary = options.dictionary;
+    size_t sharedHuffCost = dictionary ? sharedCost(freq, dictionary->tables[SHARED_BYTES]) : SIZE_MAX;
+    size_t best = min({size, rleCost, huffCost, sharedHuffCost});
+    
+    // LZ77 is skipped when runs already win outright
+    if (options.level > 0 && rleCost > size / 32) {
+        MatchParams params = matchParamsForLevel(options.level);
+        if (min(huffCost, sharedHuffCost) >= size - size / 32) params = {1, 16, false, 5};
+        out.push_back(dictionary ? METHOD_LZ_DICT : METHOD_LZ);
+        encodeLz(data, size, params, options, out);
+        if (out.size() - start - 1 <= best) return;
+        out.resize(start);
+    }
+    
+    if (best == size) {
+        out.push_back(METHOD_STORED);
+        out.insert(out.end(), data, data + size);
+    } else if (best == rleCost) {
+        out.push_back(METHOD_RLE);
+        encodeRle(data, size, out);
+    } else if (best == sharedHuffCost) {
+        out.push_back(METHOD_HUFFMAN_SHARED);
+        encodeShared(data, size, dictionary->tables[SHARED_BYTES], out, sharedHuffCost);
+    } else {
+        out.push_back(METHOD_HUFFMAN);
+        encodeHuffman(data, size, freq, out, options.maxCodeLength);
+    }
+}
+
+// Compress one block. In context-model mode, order-1 rANS replaces the order-0 choice
+// whenever it is smaller.
+void compressBlock(const uint8_t *data, size_t size, const CompressionOptions &options, vector<uint8_t> &out) {
+    size_t start = out.size();
+    compressBlockOrder0(data, size, options, out);
+    if (!options.contextModel || out[start] == METHOD_SINGLE) return;
+    vector<uint8_t> payload;
+    encodeRansO1(data, size, payload);
+    if (payload.size() + 1 < out.size() - start) {
+        out.resize(start);
+        out.push_back(METHOD_RANS_O1);
+        out.insert(out.end(), payload.begin(), payload.end());
+    }
+}
+
+// Decompress one block produced by compressBlock into `out` (exactly `rawSize` bytes);
+// the dictionary methods need the dictionary the block was compressed with
+bool decompressBlock(const uint8_t *data, size_t size, uint8_t *out, size_t rawSize,
+                     const Dictionary *dictionary = nullptr) {
+    if (size == 0) return false;
+    switch (data[0]) {
+        case METHOD_HUFFMAN: return decodeHuffman(data + 1, size - 1, out, rawSize);
+        case METHOD_LZ: return decodeLz(data + 1, size - 1, out, rawSize);
+        case METHOD_STORED:
+            if (size - 1 != rawSize) return false;
+            memcpy(out, data + 1, rawSize);
+            return true;
+        case METHOD_RLE: return decodeRle(data + 1, size - 1, out, rawSize);
+        case METHOD_SINGLE:
+            if (size != 2) return false;
+            memset(out, data[1], rawSize);
+            return true;
+        case METHOD_RANS_O1: return decodeRansO1(data + 1, size - 1, out, rawSize);
+        case METHOD_HUFFMAN_SHARED:
+            return dictionary && decodeShared(data + 1, size - 1, dictionary->tables[SHARED_BYTES], out, rawSize);
+        case METHOD_LZ_DICT: {
+            if (!dictionary) return false;
+            size_t historySize = dictionary->content.size();
+            vector<uint8_t> window(historySize + rawSize);
+            memcpy(window.data(), dictionary->content.data(), historySize);
+            if (!decodeLz(data + 1, size - 1, window.data() + historySize, rawSize, dictionary)) return false;
+            memcpy(out, window.data() + historySize, rawSize);
+            return true;
+        }
+        default: return false;
+    }
+}
+
+// Upper bound on the memory compressing one block takes: its input and output, then
+// whichever is larger of the LZ77 parse (hash chains, sequences and literals with growth
+// headroom, code streams) and the rANS payload, plus the fixed-size tables
+size_t compressionBlockMemory(size_t size, const CompressionOptions &options) {
+    size_t working = options.contextModel ? 3 * size : 0;
+    if (options.level > 0) {
+        working = max(working, 10 * size + (sizeof(int32_t) << LZ_HASH_BITS));
+        if (options.dictionary) working += options.dictionary->content.size();
+    }
+    return 3 * size + working + (1 << 20);
+}
+
+// Upper bound on the memory decoding one block takes: payload, output and the LZ77
+// streams or the rANS context tables
+size_t decompressionBlockMemory(size_t rawSize, size_t packedSize) {
+    return packedSize + 3 * rawSize + (1 << 20);
+}
+
+// Share of a memory limit available to block buffers, 0 when there is no limit
+size_t blockMemoryBudget(size_t memoryLimit) {
+    return memoryLimit > MEMORY_RESERVE ? memoryLimit - MEMORY_RESERVE : (memoryLimit ? 1 : 0);
+}
+
+// Under a memory limit, halve the block size (down to MIN_LIMITED_BLOCK_SIZE) until
+// every worker can have a block in flight; false if not even one block fits
+bool fitMemoryLimit(CompressionOptions &options) {
+    size_t budget = blockMemoryBudget(options.memoryLimit);
+    if (budget == 0) return true;
+    while (options.blockSize > MIN_LIMITED_BLOCK_SIZE &&
+           compressionBlockMemory(options.blockSize, options) * options.threads > budget) {
+        options.blockSize = max(options.blockSize / 2, MIN_LIMITED_BLOCK_SIZE);
+    }
+    return compressionBlockMemory(options.blockSize, options) <= budget;
+}
+
+const uint8_t DICTIONARY_MAGIC[4] = {'H', 'D', 'C', 'T'};
+const uint8_t DICTIONARY_VERSION = 1;
+const size_t DICTIONARY_CONTENT_SIZE = 32 << 10; // LZ77 history kept in a trained dictionary
+const int DICTIONARY_KMER = 8;                   // Substring length counted when picking content
+const size_t DICTIONARY_SEGMENT = 64;            // Unit of sample data copied into the content
+const int DICTIONARY_HASH_BITS = 20;
+
+// Parse a dictionary file: magic, version, the shared code lengths, then the content
+bool parseDictionary(const vector<uint8_t> &file, Dictionary &dictionary) {
+    size_t pos = 5;
+    if (file.size() < pos || memcmp(file.data(), DICTIONARY_MAGIC, 4) != 0 || file[4] != DICTIONARY_VERSION) {
+        return false;
+    }
+    for (auto &table : dictionary.tables) {
+        if (!readCodeLengths(file.data(), file.size(), pos, table.lengths) ||
+            !buildDecodeTable(table.lengths, table.decode)) {
+            return false;
+        }
+        generateHuffmanCodes(table.lengths, table.codes);
+    }
+    uint64_t contentSize = 0;
+    if (!readVarint(file.data(), file.size(), pos, contentSize) || contentSize != file.size() - pos) return false;
+    dictionary.content.assign(file.begin() + pos, file.end());
+    buildLzHistory(dictionary.content, dictionary.chains);
+    dictionary.id = crc32c(file.data(), file.size());
+    return true;
+}
+
+} // namespace
+
+bool loadDictionary(const string &filename, Dictionary &dictionary) {
+    ifstream in(filename, ios::binary);
+    vector<uint8_t> file((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    return in.good() || in.eof() ? parseDictionary(file, dictionary) : false;
+}
+
+namespace {
+
+// Whether a file that may need a dictionary can be decoded with the one given
+bool checkDictionary(const ContainerInfo &info, const Dictionary *dictionary) {
+    if (!(info.flags & FLAG_DICTIONARY) || (dictionary && dictionary->id == info.dictionaryId)) return true;
+    cerr << "Error: input was compressed with dictionary " << hex << setw(8) << setfill('0')
+         << info.dictionaryId << dec << setfill(' ') << (dictionary ? ", not the one given" : "; pass it with -D")
+         << endl;
+    return false;
+}
+
+// Pick dictionary content from the samples: substrings that recur across many samples,
+// chosen greedily a segment at a time so each pick adds substrings not yet covered.
+// The most valuable segments end up last, where offsets from the data are shortest.
+vector<uint8_t> selectDictionaryContent(const vector<vector<uint8_t>> &samples, size_t budget) {
+    size_t total = 0;
+    for (const auto &sample : samples) total += sample.size();
+    if (total <= budget) {
+        vector<uint8_t> content;
+        for (const auto &sample : samples) content.insert(content.end(), sample.begin(), sample.end());
+        return content;
+    }
+    
+    // Number of samples containing each (hashed) k-mer
+    auto hashAt = [](const uint8_t *p) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        return static_cast<uint32_t>((word * 0x9E3779B97F4A7C15ull) >> (64 - DICTIONARY_HASH_BITS));
+    };
+    vector<uint32_t> sampleCount(size_t(1) << DICTIONARY_HASH_BITS, 0);
+    vector<uint32_t> lastSample(sampleCount.size(), UINT32_MAX);
+    for (uint32_t i = 0; i < samples.size(); i++) {
+        for (size_t p = 0; p + DICTIONARY_KMER <= samples[i].size(); p++) {
+            uint32_t h = hashAt(samples[i].data() + p);
+            if (lastSample[h] != i) {
+                lastSample[h] = i;
+                sampleCount[h]++;
+            }
+        }
+    }
+    
+    // A segment scores the k-mers it starts that occur in more than one sample
+    struct Segment {
+        const uint8_t *data;
+        size_t size;
+    };
+    vector<Segment> segments;
+    for (const auto &sample : samples) {
+        for (size_t p = 0; p + DICTIONARY_KMER <= sample.size(); p += DICTIONARY_SEGMENT) {
+            segments.push_back({sample.data() + p, min(DICTIONARY_SEGMENT, sample.size() - p)});
+        }
+    }
+    auto score = [&](const Segment &segment) {
+        uint64_t sum = 0;
+        for (size_t p = 0; p + DICTIONARY_KMER <= segment.size; p++) {
+            uint32_t count = sampleCount[hashAt(segment.data + p)];
+            if (count > 1) sum += count;
+        }
+        return sum;
+    };
+    
+    // Lazy greedy selection: scores only drop as k-mers get covered, so a popped segment
+    // whose fresh score still beats the next candidate is the true best
+    priority_queue<pair<uint64_t, size_t>> candidates;
+    for (size_t i = 0; i < segments.size(); i++) candidates.push({score(segments[i]), i});
+    vector<size_t> chosen;
+    size_t used = 0;
+    while (!candidates.empty() && used < budget) {
+        size_t i = candidates.top().second;
+        candidates.pop();
+        uint64_t current = score(segments[i]);
+        if (current == 0) continue;
+        if (!candidates.empty() && current < candidates.top().first) {
+            candidates.push({current, i});
+            continue;
+        }
+        chosen.push_back(i);
+        used += segments[i].size;
+        for (size_t p = 0; p + DICTIONARY_KMER <= segments[i].size; p++) {
+            sampleCount[hashAt(segments[i].data + p)] = 0;
+        }
+    }
+    
+    vector<uint8_t> content;
+    for (auto it = chosen.rbegin(); it != chosen.rend(); ++it) {
+        content.insert(content.end(), segments[*it].data, segments[*it].data + segments[*it].size);
+    }
+    if (content.size() > budget) content.erase(content.begin(), content.begin() + (content.size() - budget));
+    return content;
+}
+
+// Code lengths for a shared table from training counts. Every symbol below `symbols`
+// gets a code, so data unlike the samples can still use the table.
+void sharedCodeLengths(const uint64_t counts[256], int symbols, int maxCodeLength, uint8_t lengths[256]) {
+    uint64_t total = 0;
+    for (int s = 0; s < 256; s++) total += counts[s];
+    int shift = 0;
+    while ((total >> shift) >= (uint64_t(1) << 24)) shift++;
+    uint32_t freq[256] = {0};
+    for (int s = 0; s < symbols; s++) freq[s] = static_cast<uint32_t>(counts[s] >> shift) + 1;
+    computeCodeLengths(freq, lengths, maxCodeLength);
+}
+
+// Build a dictionary file from sample inputs: content first, then code tables from
+// the symbol statistics of each sample parsed against that content
+vector<uint8_t> trainDictionary(const vector<vector<uint8_t>> &samples, const CompressionOptions &options) {
+    vector<uint8_t> content = selectDictionaryContent(samples, DICTIONARY_CONTENT_SIZE);
+    uint64_t counts[SHARED_TABLE_COUNT][256] = {{0}};
+    MatchParams params = matchParamsForLevel(max(options.level, 1));
+    LzHistory chains;
+    buildLzHistory(content, chains);
+    
+    for (const auto &sample : samples) {
+        uint32_t freq[256];
+        calculateFrequencies(sample.data(), sample.size(), freq);
+        for (int s = 0; s < 256; s++) counts[SHARED_BYTES][s] += freq[s];
+        
+        vector<uint8_t> history(content);
+        history.insert(history.end(), sample.begin(), sample.end());
+        vector<LzSequence> sequences;
+        vector<uint8_t> literals;
+        findSequences(history.data(), history.size(), params, options.windowBits, sequences, literals, content.size(),
+                      &chains);
+        for (uint8_t literal : literals) counts[SHARED_LITERALS][literal]++;
+        for (const auto &seq : sequences) {
+            uint8_t code;
+            uint32_t extra;
+            int extraBits;
+            encodeValue(seq.literalLength, code, extra, extraBits);
+            counts[SHARED_LITERAL_LENGTHS][code]++;
+            encodeValue(seq.matchLength - MIN_MATCH, code, extra, extraBits);
+            counts[SHARED_MATCH_LENGTHS][code]++;
+            encodeValue(seq.offset - 1, code, extra, extraBits);
+            counts[SHARED_OFFSETS][code]++;
+        }
+    }
+    
+    // Value codes stop at 16 + 28 * 4; byte tables cover every byte
+    vector<uint8_t> file(DICTIONARY_MAGIC, DICTIONARY_MAGIC + 4);
+    file.push_back(DICTIONARY_VERSION);
+    for (int t = 0; t < SHARED_TABLE_COUNT; t++) {
+        bool bytes = t == SHARED_LITERALS || t == SHARED_BYTES;
+        uint8_t lengths[256];
+        sharedCodeLengths(counts[t], bytes ? 256 : 16 + 28 * 4, options.maxCodeLength, lengths);
+        writeCodeLengths(lengths, file);
+    }
+    writeVarint(file, content.size());
+    file.insert(file.end(), content.begin(), content.end());
+    return file;
+}
+
+// Fixed-size worker pool; tasks run in submission order across the workers
+class ThreadPool {
+private:
+    vector<thread> workers;
+    queue<packaged_task<void()>> tasks;
+    mutex lock;
+    condition_variable ready;
+    bool stopping = false;
+
+    void workerLoop() {
+        while (true) {
+            packaged_task<void()> task;
+            {
+                unique_lock<mutex> guard(lock);
+                ready.wait(guard, [this] { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty()) return;
+                task = move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+public:
+    explicit ThreadPool(unsigned threads) {
+        for (unsigned i = 0; i < max(threads, 1u); i++) {
+            workers.emplace_back(&ThreadPool::workerLoop, this);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (auto &worker : workers) worker.join();
+    }
+
+    future<void> submit(function<void()> job) {
+        packaged_task<void()> task(move(job));
+        future<void> result = task.get_future();
+        {
+            lock_guard<mutex> guard(lock);
+            tasks.push(move(task));
+        }
+        ready.notify_one();
+        return result;
+    }
+
+    unsigned size() const { return static_cast<unsigned>(workers.size()); }
+};
+
+// Pool for jobs of very different sizes. Each worker owns a deque. Jobs submitted from
+// outside are dealt round-robin to the back of the deques and run in submission order.
+// Jobs may submit more jobs (e.g. the blocks of a large file); those go to the front of
+// the submitting worker's deque, ahead of its pending submissions, where the owner runs
+// the newest first and idle workers steal the oldest.
+class WorkStealingPool {
+private:
+    struct WorkerQueue {
+        deque<function<void()>> jobs; // Spawned jobs (newest first), then submissions
+        size_t spawned = 0;           // Length of the spawned range at the front
+        mutex lock;
+    };
+    vector<unique_ptr<WorkerQueue>> queues;
+    vector<thread> workers;
+    mutex idleLock;
+    condition_variable wake;     // Workers: a job was queued, or the pool is stopping
+    condition_variable finished; // wait(): no jobs left
+    size_t queued = 0;           // Jobs waiting in any deque (guarded by idleLock)
+    size_t pending = 0;          // Jobs queued or running (guarded by idleLock)
+    size_t nextQueue = 0;
+    bool stopping = false;
+    
+    static thread_local WorkStealingPool *currentPool;
+    static thread_local size_t currentWorker;
+    
+    // The owner takes from the front: its most recently spawned job, or else its oldest
+    // submission. A thief takes the oldest job the victim spawned, from the back of the
+    // spawned range, so the blocks of one file spread over the workers in file order;
+    // with none spawned it takes the victim's oldest submission.
+    bool take(size_t self, function<void()> &job) {
+        for (size_t k = 0; k < queues.size(); k++) {
+            WorkerQueue &queue = *queues[(self + k) % queues.size()];
+            lock_guard<mutex> guard(queue.lock);
+            if (queue.jobs.empty()) continue;
+            auto it = k > 0 && queue.spawned > 0 ? queue.jobs.begin() + (queue.spawned - 1) : queue.jobs.begin();
+            if (queue.spawned > 0) queue.spawned--;
+            job = move(*it);
+            queue.jobs.erase(it);
+            return true;
+        }
+        return false;
+    }
+    
+    void workerLoop(size_t self) {
+        currentPool = this;
+        currentWorker = self;
+        while (true) {
+            {
+                unique_lock<mutex> guard(idleLock);
+                wake.wait(guard, [this] { return stopping || queued > 0; });
+                if (queued == 0) return;
+                queued--;
+            }
+            // A job is reserved for this worker, though it may sit in another's deque
+            function<void()> job;
+            while (!take(self, job)) this_thread::yield();
+            job();
+            lock_guard<mutex> guard(idleLock);
+            if (--pending == 0) finished.notify_all();
+        }
+    }
+
+public:
+    explicit WorkStealingPool(unsigned threads) {
+        for (unsigned i = 0; i < max(threads, 1u); i++) queues.emplace_back(new WorkerQueue);
+        for (unsigned i = 0; i < max(threads, 1u); i++) workers.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+    
+    ~WorkStealingPool() {
+        {
+            lock_guard<mutex> guard(idleLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers) worker.join();
+    }
+    
+    void submit(function<void()> job) {
+        size_t target;
+        bool spawned = currentPool == this;
+        {
+            lock_guard<mutex> guard(idleLock);
+            target = spawned ? currentWorker : nextQueue++ % queues.size();
+        }
+        {
+            lock_guard<mutex> guard(queues[target]->lock);
+            if (spawned) {
+                queues[target]->jobs.push_front(move(job));
+                queues[target]->spawned++;
+            } else {
+                queues[target]->jobs.push_back(move(job));
+            }
+        }
+        {
+            lock_guard<mutex> guard(idleLock);
+            queued++;
+            pending++;
+        }
+        wake.notify_one();
+    }
+    
+    // Block until every submitted job, including jobs they submitted, has run
+    void wait() {
+        unique_lock<mutex> guard(idleLock);
+        finished.wait(guard, [this] { return pending == 0; });
+    }
+    
+    unsigned size() const { return static_cast<unsigned>(workers.size()); }
+};
+
+thread_local WorkStealingPool *WorkStealingPool::currentPool = nullptr;
+thread_local size_t WorkStealingPool::currentWorker = 0;
+
+// Number of worker threads to use when the caller does not choose
+unsigned defaultThreadCount() {
+    return max(thread::hardware_concurrency(), 1u);
+}
+
+// Input file exposed as a sequence of contiguous blocks: memory-mapped when possible,
+// otherwise read through a stream (pipes, devices, platforms without mmap)
+class InputSource {
+private:
+    const uint8_t *mapped = nullptr;
+    size_t mappedSize = 0;
+    size_t position = 0;
+    bool ownsMapping = false;
+    int descriptor = -1;         // Unmappable file (FIFO, device) streamed with read()
+    bool ended = false;          // The last next() reached the end of the input
+    ifstream file;
+    istream *stream = nullptr;
+
+    // Map a regular file; false leaves the descriptor to the streaming fallback
+    bool mapDescriptor(int fd) {
+#ifndef _WIN32
+        struct stat info;
+        if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) return false;
+        off_t start = lseek(fd, 0, SEEK_CUR);
+        if (start < 0 || start > info.st_size) return false;
+        size_t length = static_cast<size_t>(info.st_size);
+        if (length == 0) {
+            mapped = reinterpret_cast<const uint8_t*>("");
+            return true;
+        }
+        void *region = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (region == MAP_FAILED) return false;
+        madvise(region, length, MADV_SEQUENTIAL);
+        mapped = static_cast<const uint8_t*>(region);
+        mappedSize = length;
+        ownsMapping = true;
+        position = static_cast<size_t>(start);
+        return true;
+#else
+        (void)fd;
+        return false;
+#endif
+    }
+
+public:
+    InputSource() = default;
+    InputSource(const InputSource &) = delete;
+    InputSource &operator=(const InputSource &) = delete;
+    
+    ~InputSource() {
+#ifndef _WIN32
+        if (ownsMapping) munmap(const_cast<uint8_t*>(mapped), mappedSize);
+        if (descriptor >= 0) ::close(descriptor);
+#endif
+    }
+    
+    // The path is opened once: a regular file is mapped, anything else is streamed from
+    // the same descriptor (reopening a FIFO by name would drop its writer and then block)
+    bool open(const string &filename) {
+#ifndef _WIN32
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        if (mapDescriptor(fd)) {
+            ::close(fd);
+        } else {
+            descriptor = fd;
+        }
+        return true;
+#else
+        file.open(filename, ios::binary);
+        stream = &file;
+        return static_cast<bool>(file);
+#endif
+    }
+    
+    // Standard input: mapped when redirected from a regular file, streamed from pipes
+    bool openStdin() {
+#ifndef _WIN32
+        if (mapDescriptor(STDIN_FILENO)) return true;
+#endif
+        stream = &cin;
+        return true;
+    }
+    
+    // Caller-owned buffer, which must outlive the source
+    void openMemory(const uint8_t *data, size_t size) {
+        mapped = size ? data : reinterpret_cast<const uint8_t*>("");
+        mappedSize = size;
+    }
+    
+    bool isMapped() const { return mapped != nullptr; }
     
-    HuffmanNode(char data, unsigned freq) : 
-        data(data), freq(freq), left(nullptr), right(nullptr) {}
+    // Whether the input is known to be used up: a mapping knows at its last byte, a
+    // stream only once a read comes up short
+    bool atEnd() const { return ended; }
+    
+    // Drop the resident pages of a block that has been fully consumed, so a mapping
+    // does not keep the whole file in memory (no-op for streamed input)
+    void release(const uint8_t *data, size_t size) {
+#ifndef _WIN32
+        if (!ownsMapping || size == 0) return;
+        uintptr_t pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+        uintptr_t first = (reinterpret_cast<uintptr_t>(data) + pageSize - 1) & ~(pageSize - 1);
+        uintptr_t last = (reinterpret_cast<uintptr_t>(data) + size) & ~(pageSize - 1);
+        if (last > first) madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED);
+#else
+        (void)data;
+        (void)size;
+#endif
+    }
+    
+    // Next block of up to `maxSize` bytes: a view into the mapping, or read into `storage`
+    size_t next(size_t maxSize, vector<uint8_t> &storage, const uint8_t *&data) {
+        if (mapped) {
+            size_t n = min(maxSize, mappedSize - position);
+            data = mapped + position;
+            position += n;
+            ended = position == mappedSize;
+            return n;
+        }
+        storage.resize(maxSize);
+#ifndef _WIN32
+        if (descriptor >= 0) {
+            size_t filled = 0;
+            while (filled < maxSize) {
+                ssize_t n = ::read(descriptor, storage.data() + filled, maxSize - filled);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break;
+                filled += static_cast<size_t>(n);
+            }
+            storage.resize(filled);
+            data = storage.data();
+            ended = filled < maxSize;
+            return filled;
+        }
+#endif
+        stream->read(reinterpret_cast<char*>(storage.data()), maxSize);
+        storage.resize(static_cast<size_t>(stream->gcount()));
+        data = storage.data();
+        ended = storage.size() < maxSize;
+        return storage.size();
+    }
 };
 
-// Comparison for priority queue
-struct Compare {
-    bool operator()(HuffmanNode* l, HuffmanNode* r) {
-        return l->freq > r->freq;
-    }
+// A block travelling through the compression or decompression pipeline
+struct BlockJob {
+    const uint8_t *input = nullptr; // Raw bytes to compress (mapped file or `raw`)
+    size_t inputSize = 0;
+    vector<uint8_t> raw;
+    vector<uint8_t> packed;
+    size_t id = 0;                  // Position of the block in the block index
+    uint32_t checksum = 0;
+    bool ok = true;
+    bool coded = false;             // compressDirectory: payload ready to write
+    future<void> done;
+};
+
+} // namespace
+
+// Totals reported after compressing a stream
+struct CompressionStats {
+    uint64_t originalSize = 0;
+    uint64_t compressedSize = 0;
+    uint32_t checksum = 0; // CRC32C of the original data
 };
 
-// Utility function to print Huffman codes
-void printCodes(HuffmanNode* root, string str, unordered_map<char, string> &huffmanCode) {
-    if (!root) return;
+namespace {
+
+// Writes the container around a sequence of compressed blocks: header, blocks in order,
+// terminator, then (unless the file is flagged as a single block) the index and footer
+class ContainerWriter {
+private:
+    ostream &out;
+    const CompressionOptions &options;
+    vector<BlockIndexEntry> index;
+    bool started = false, singleBlock = false;
+
+public:
+    CompressionStats stats;
     
-    if (root->data != '\0') {
-        huffmanCode[root->data] = str;
-    }
+    ContainerWriter(ostream &output, const CompressionOptions &compressionOptions)
+        : out(output), options(compressionOptions) {}
     
-    printCodes(root->left, str + "0", huffmanCode);
-    printCodes(root->right, str + "1", huffmanCode);
-}
-
-// Build Huffman Tree and return root
-HuffmanNode* buildHuffmanTree(const unordered_map<char, unsigned> &freqMap) {
-    priority_queue<HuffmanNode*, vector<HuffmanNode*>, Compare> minHeap;
+    bool hasStarted() const { return started; }
     
-    // Create leaf nodes and push to min heap
-    for (auto pair : freqMap) {
-        minHeap.push(new HuffmanNode(pair.first, pair.second));
+    // Files of at most one block skip the index and footer, which would only repeat
+    // the block's own header
+    void begin(bool single) {
+        singleBlock = single;
+        uint8_t flags = singleBlock ? FLAG_SINGLE_BLOCK : 0;
+        if (options.dictionary) flags |= FLAG_DICTIONARY;
+        stats.compressedSize = writeContainerHeader(out, flags, options.dictionary ? options.dictionary->id : 0);
+        started = true;
     }
     
-    // Build Huffman Tree
-    while (minHeap.size() != 1) {
-        HuffmanNode *left = minHeap.top(); minHeap.pop();
-        HuffmanNode *right = minHeap.top(); minHeap.pop();
-        
-        HuffmanNode *top = new HuffmanNode('\0', left->freq + right->freq);
-        top->left = left;
-        top->right = right;
-        minHeap.push(top);
+    // Each block is written as: raw size, payload size, CRC32C of the raw block, payload
+    void addBlock(size_t rawSize, uint32_t checksum, const vector<uint8_t> &packed) {
+        stats.checksum = crc32cCombine(stats.checksum, checksum, rawSize);
+        vector<uint8_t> header;
+        writeVarint(header, rawSize);
+        writeVarint(header, packed.size());
+        putU32(header, checksum);
+        out.write(reinterpret_cast<const char*>(header.data()), header.size());
+        out.write(reinterpret_cast<const char*>(packed.data()), packed.size());
+        stats.compressedSize += header.size();
+        index.push_back({stats.compressedSize, static_cast<uint32_t>(packed.size()),
+                         static_cast<uint32_t>(rawSize), checksum, 0});
+        stats.compressedSize += packed.size();
+        stats.originalSize += rawSize;
     }
     
-    return minHeap.top();
-}
-
-// Generate Huffman codes
-unordered_map<char, string> generateHuffmanCodes(HuffmanNode* root) {
-    unordered_map<char, string> huffmanCode;
-    printCodes(root, "", huffmanCode);
-    return huffmanCode;
-}
+    // A zero raw size marks the end of the block sequence; the seekable index follows
+    bool finish() {
+        out.put(0);
+        stats.compressedSize += 1;
+        if (!singleBlock) {
+            writeBlockIndex(out, index, stats.compressedSize, stats.originalSize, stats.checksum);
+            stats.compressedSize += index.size() * INDEX_ENTRY_SIZE + INDEX_FOOTER_SIZE;
+        }
+        out.flush();
+        return static_cast<bool>(out);
+    }
+};
 
-// Calculate frequency of each character in file
-unordered_map<char, unsigned> calculateFrequencies(const string &filename) {
-    ifstream file(filename, ios::binary);
-    if (!file) {
-        cerr << "Error opening file: " << filename << endl;
-        exit(1);
+// Compress a stream using Huffman coding: independent blocks are coded on a thread pool
+// and written in order, with at most two blocks per thread in flight. Input that ends
+// within its first block is coded on the calling thread without starting the pool. Under
+// a memory limit, the blocks in flight also fit its budget and mapped input is released
+// as it is written; options should have been through fitMemoryLimit.
+bool compressStream(InputSource &input, ostream &out, const CompressionOptions &options,
+                    CompressionStats &stats) {
+    ContainerWriter writer(out, options);
+    auto code = [&options](BlockJob *j) {
+        j->checksum = crc32c(j->input, j->inputSize);
+        compressBlock(j->input, j->inputSize, options, j->packed);
+    };
+    
+    unique_ptr<BlockJob> job(new BlockJob);
+    job->inputSize = input.next(options.blockSize, job->raw, job->input);
+    if (job->inputSize == 0 || input.atEnd()) {
+        writer.begin(true);
+        if (job->inputSize > 0) {
+            code(job.get());
+            writer.addBlock(job->inputSize, job->checksum, job->packed);
+        }
+        bool ok = writer.finish();
+        stats = writer.stats;
+        return ok;
     }
     
-    unordered_map<char, unsigned> freqMap;
-    char ch;
-    while (file.get(ch)) {
-        freqMap[ch]++;
+    ThreadPool pool(options.threads);
+    deque<unique_ptr<BlockJob>> inFlight;
+    bool inputEnded = false;
+    size_t maxInFlight = 2 * pool.size();
+    if (size_t budget = blockMemoryBudget(options.memoryLimit)) {
+        maxInFlight = min(maxInFlight, max<size_t>(budget / compressionBlockMemory(options.blockSize, options), 1));
     }
-    file.close();
-    return freqMap;
+    
+    // The header is written once the first block is done, when it is known whether the
+    // input fits in one block
+    auto writeOldest = [&]() {
+        if (!writer.hasStarted()) writer.begin(inputEnded && inFlight.size() <= 1);
+        unique_ptr<BlockJob> job = move(inFlight.front());
+        inFlight.pop_front();
+        job->done.get();
+        writer.addBlock(job->inputSize, job->checksum, job->packed);
+        if (options.memoryLimit) input.release(job->input, job->inputSize);
+    };
+    
+    while (job->inputSize > 0) {
+        BlockJob *j = job.get();
+        job->done = pool.submit([j, &code] { code(j); });
+        inFlight.push_back(move(job));
+        if (inFlight.size() >= maxInFlight) writeOldest();
+        
+        job.reset(new BlockJob);
+        job->inputSize = input.next(options.blockSize, job->raw, job->input);
+    }
+    inputEnded = true;
+    while (!inFlight.empty()) writeOldest();
+    bool ok = writer.finish();
+    stats = writer.stats;
+    return ok;
 }
 
-// Compress file using Huffman coding
-void compressFile(const string &inputFile, const string &outputFile) {
-    // Step 1: Calculate frequencies
-    auto freqMap = calculateFrequencies(inputFile);
+} // namespace
+
+// Caller-owned byte ranges for StreamCompressor; each call advances `data` and shrinks
+// `size` by the bytes it consumed or produced
+struct InputSpan {
+    const uint8_t *data;
+    size_t size;
+};
+
+struct OutputSpan {
+    uint8_t *data;
+    size_t size;
+};
+
+// Incremental compressor for embedding: the caller pushes input and pulls output through
+// its own buffers, and the context performs no I/O. The output is the container the
+// command line writes, coded one block at a time on the calling thread. Full blocks are
+// coded straight from the caller's input; only partial blocks are gathered. A context
+// can be reused for any number of streams, since init() keeps its buffers.
+//
+//   stream.init(options), which rejects a zero block size;
+//   for each chunk: stream.compress(in, out), draining `out` whenever it fills
+//   stream.flush(out) to make everything pushed so far decodable (optional)
+//   repeat stream.end(out), draining `out`, until it returns 0
+class StreamCompressor {
+private:
+    static const size_t MAX_BLOCK_HEADER = 24; // Two varints and a CRC32C
     
-    // Step 2: Build Huffman Tree
-    HuffmanNode* root = buildHuffmanTree(freqMap);
+    CompressionOptions options;
+    vector<uint8_t> block;   // Input gathered for the next block
+    vector<uint8_t> pending; // Coded bytes not yet handed to the caller
+    vector<uint8_t> header;
+    size_t pendingPos = 0;
+    vector<BlockIndexEntry> index;
+    CompressionStats stats;
+    bool started = false, singleBlock = false, ended = false;
     
-    // Step 3: Generate Huffman codes
-    auto huffmanCode = generateHuffmanCodes(root);
+    bool drained() const { return pendingPos == pending.size(); }
     
-    // Step 4: Write compressed data
-    ifstream inFile(inputFile, ios::binary);
-    ofstream outFile(outputFile, ios::binary);
+    void drain(OutputSpan &out) {
+        size_t n = min(out.size, pending.size() - pendingPos);
+        if (n == 0) return;
+        memcpy(out.data, pending.data() + pendingPos, n);
+        out.data += n;
+        out.size -= n;
+        pendingPos += n;
+    }
     
-    // Write header (frequency map for reconstruction)
-    outFile << freqMap.size() << "\n";
-    for (auto pair : freqMap) {
-        outFile << (int)pair.first << " " << pair.second << "\n";
+    // The container header goes out with the first block; a stream that ends within its
+    // first block is written as a single block without an index
+    void start(bool single) {
+        singleBlock = single;
+        uint8_t flags = singleBlock ? FLAG_SINGLE_BLOCK : 0;
+        if (options.dictionary) flags |= FLAG_DICTIONARY;
+        appendContainerHeader(pending, flags, options.dictionary ? options.dictionary->id : 0);
+        stats.compressedSize = pending.size();
+        started = true;
     }
     
-    // Write compressed data
-    string encodedStr = "";
-    char ch;
-    while (inFile.get(ch)) {
-        encodedStr += huffmanCode[ch];
+    // Code one block into the drained pending buffer. The payload is coded after room
+    // for the largest block header, which is then filled in right-aligned (moving the
+    // few bytes of container header along with it) so the payload is never copied.
+    void emitBlock(const uint8_t *data, size_t size, bool last) {
+        pending.clear();
+        pendingPos = 0;
+        if (!started) start(last);
+        size_t prefix = pending.size();
+        pending.resize(prefix + MAX_BLOCK_HEADER);
+        compressBlock(data, size, options, pending);
+        size_t packedSize = pending.size() - prefix - MAX_BLOCK_HEADER;
+        uint32_t checksum = crc32c(data, size);
+        
+        header.clear();
+        writeVarint(header, size);
+        writeVarint(header, packedSize);
+        putU32(header, checksum);
+        pendingPos = MAX_BLOCK_HEADER - header.size();
+        memmove(pending.data() + pendingPos, pending.data(), prefix);
+        memcpy(pending.data() + pendingPos + prefix, header.data(), header.size());
+        
+        stats.compressedSize += header.size();
+        index.push_back({stats.compressedSize, static_cast<uint32_t>(packedSize), static_cast<uint32_t>(size),
+                         checksum, 0});
+        stats.compressedSize += packedSize;
+        stats.originalSize += size;
+        stats.checksum = crc32cCombine(stats.checksum, checksum, size);
+    }
+
+public:
+    // Begin a new stream; options.dictionary, if any, must outlive it. False for a zero
+    // block size, which leaves the context ended so that no call produces output.
+    bool init(const CompressionOptions &compressionOptions) {
+        options = compressionOptions;
+        block.clear();
+        block.reserve(options.blockSize);
+        pending.clear();
+        pendingPos = 0;
+        index.clear();
+        stats = CompressionStats();
+        started = singleBlock = false;
+        ended = options.blockSize == 0;
+        return !ended;
     }
-    inFile.close();
     
-    // Pad the string to make its length multiple of 8
-    int padding = 8 - (encodedStr.length() % 8);
-    for (int i = 0; i < padding; i++) {
-        encodedStr += "0";
+    // Consume input and produce output until the input is used up or the output is full
+    void compress(InputSpan &in, OutputSpan &out) {
+        drain(out);
+        while (!ended && in.size > 0 && drained()) {
+            size_t n;
+            if (block.empty() && in.size >= options.blockSize) {
+                n = options.blockSize;
+                emitBlock(in.data, n, false);
+            } else {
+                n = min(in.size, options.blockSize - block.size());
+                block.insert(block.end(), in.data, in.data + n);
+                if (block.size() == options.blockSize) {
+                    emitBlock(block.data(), block.size(), false);
+                    block.clear();
+                }
+            }
+            in.data += n;
+            in.size -= n;
+            drain(out);
+        }
     }
     
-    // Write padding info
-    outFile << padding << "\n";
+    // Code the input gathered so far as a block of its own, so that everything pushed
+    // can be decoded from the output. Returns the bytes still waiting for output space;
+    // call again with more space until it returns 0.
+    size_t flush(OutputSpan &out) {
+        drain(out);
+        if (!ended && !block.empty() && drained()) {
+            emitBlock(block.data(), block.size(), false);
+            block.clear();
+            drain(out);
+        }
+        return pending.size() - pendingPos;
+    }
     
-    // Convert binary string to bytes and write
-    for (size_t i = 0; i < encodedStr.length(); i += 8) {
-        string byteStr = encodedStr.substr(i, 8);
-        bitset<8> bits(byteStr);
-        char byte = static_cast<char>(bits.to_ulong());
-        outFile.put(byte);
+    // Finish the stream: last block, end marker and block index. Returns the bytes still
+    // waiting for output space; call again with more space until it returns 0.
+    size_t end(OutputSpan &out) {
+        drain(out);
+        if (!ended && drained()) {
+            if (!block.empty()) {
+                emitBlock(block.data(), block.size(), !started);
+                block.clear();
+            } else if (!started) {
+                pending.clear();
+                pendingPos = 0;
+                start(true);
+            }
+            pending.push_back(0);
+            stats.compressedSize += 1;
+            if (!singleBlock) {
+                appendBlockIndex(pending, index, stats.compressedSize, stats.originalSize, stats.checksum);
+                stats.compressedSize += index.size() * INDEX_ENTRY_SIZE + INDEX_FOOTER_SIZE;
+            }
+            ended = true;
+        }
+        drain(out);
+        return pending.size() - pendingPos;
     }
     
+    // Sizes and checksum of the stream so far
+    const CompressionStats &totals() const { return stats; }
+};
+
+namespace {
+
+// Compress file using Huffman coding
+[[maybe_unused]] void compressFile(const string &inputFile, const string &outputFile,
+                  const CompressionOptions &options = CompressionOptions()) {
+    InputSource input;
+    if (!input.open(inputFile)) {
+        cerr << "Error opening file: " << inputFile << endl;
+        return;
+    }
+    ofstream outFile(outputFile, ios::binary);
+    CompressionStats stats;
+    if (!compressStream(input, outFile, options, stats)) {
+        cerr << "Error writing file: " << outputFile << endl;
+        return;
+    }
     outFile.close();
     
     cout << "File compressed successfully!" << endl;
-    cout << "Original size: " << encodedStr.length()/8 - padding/8 << " bytes" << endl;
-    cout << "Compressed size: " << encodedStr.length()/8 << " bytes" << endl;
+    cout << "Original size: " << stats.originalSize << " bytes" << endl;
+    cout << "Compressed size: " << stats.compressedSize << " bytes" << endl;
+}
+
+// Decode blocks on a thread pool. `fetch` fills the next job's payload and raw size,
+// returning false when no blocks remain; `sink` receives decoded blocks in order and
+// returns false to reject one. False if a block fails to decode or is rejected.
+// Under a memory limit, a block is only fetched once the blocks in flight leave room
+// for one as large as the largest seen so far. The pool is only started once a second
+// block is waiting; a lone block is decoded on the calling thread.
+bool decodeBlocks(unsigned threads, const function<bool(BlockJob &)> &fetch,
+                  const function<bool(BlockJob &)> &sink, const Dictionary *dictionary,
+                  size_t memoryLimit = 0) {
+    auto decode = [dictionary](BlockJob *j) {
+        j->ok = decompressBlock(j->packed.data(), j->packed.size(), j->raw.data(), j->raw.size(), dictionary);
+        j->checksum = crc32c(j->raw.data(), j->raw.size());
+    };
+    unique_ptr<ThreadPool> pool;
+    deque<unique_ptr<BlockJob>> inFlight;
+    bool ok = true;
+    size_t budget = blockMemoryBudget(memoryLimit);
+    size_t inFlightMemory = 0, largestBlock = 0;
+    
+    // A job that was never submitted is decoded here
+    auto finishOldest = [&]() {
+        unique_ptr<BlockJob> job = move(inFlight.front());
+        inFlight.pop_front();
+        if (job->done.valid()) {
+            job->done.get();
+        } else {
+            decode(job.get());
+        }
+        inFlightMemory -= decompressionBlockMemory(job->raw.size(), job->packed.size());
+        ok = ok && job->ok && sink(*job);
+    };
+    
+    // Payloads are fetched on this thread; workers decode and checksum them
+    while (ok) {
+        while (budget && !inFlight.empty() && inFlightMemory + largestBlock > budget) finishOldest();
+        unique_ptr<BlockJob> job(new BlockJob);
+        if (!fetch(*job)) break;
+        size_t memory = decompressionBlockMemory(job->raw.size(), job->packed.size());
+        inFlightMemory += memory;
+        largestBlock = max(largestBlock, memory);
+        inFlight.push_back(move(job));
+        
+        if (!pool) {
+            if (inFlight.size() < 2) continue;
+            pool.reset(new ThreadPool(threads));
+        }
+        for (auto &waiting : inFlight) {
+            BlockJob *j = waiting.get();
+            if (!j->done.valid()) j->done = pool->submit([j, decode] { decode(j); });
+        }
+        if (inFlight.size() >= 2 * pool->size()) finishOldest();
+    }
+    while (!inFlight.empty()) finishOldest();
+    return ok;
+}
+
+// Decode blocks [first, last) of an indexed file, passing each verified block to `sink`
+// in file order; false on the first unreadable or corrupt block
+bool decodeIndexedBlocks(istream &in, const vector<BlockIndexEntry> &index, size_t first, size_t last,
+                         unsigned threads, const Dictionary *dictionary, size_t memoryLimit,
+                         const function<void(const BlockIndexEntry &, const vector<uint8_t> &)> &sink) {
+    bool readOk = true;
+    size_t next = first;
+    bool ok = decodeBlocks(threads,
+        [&](BlockJob &job) {
+            if (next == last) return false;
+            const BlockIndexEntry &entry = index[next];
+            job.id = next++;
+            job.packed.resize(entry.packedSize);
+            job.raw.resize(entry.rawSize);
+            in.seekg(entry.offset);
+            readOk = static_cast<bool>(in.read(reinterpret_cast<char*>(job.packed.data()), job.packed.size()));
+            return readOk;
+        },
+        [&](BlockJob &job) {
+            if (job.checksum != index[job.id].checksum) return false;
+            sink(index[job.id], job.raw);
+            return true;
+        }, dictionary, memoryLimit);
+    return ok && readOk;
+}
+
+// Decompress a stream read strictly front to back (e.g. a pipe). Blocks are decoded in
+// parallel as they arrive and each is checked against the checksum in its header before
+// it is written; the whole-file checksum and the trailing index are checked at the end.
+bool decompressStream(istream &in, ostream &out, unsigned threads, const Dictionary *dictionary = nullptr,
+                      size_t memoryLimit = 0) {
+    ContainerInfo info;
+    if (!readContainerHeader(in, info) || !checkDictionary(info, dictionary)) return false;
+    bool readOk = true, ended = false;
+    vector<uint32_t> checksums;
+    uint32_t fileChecksum = 0;
+    uint64_t totalSize = 0;
+    bool ok = decodeBlocks(threads,
+        [&](BlockJob &job) {
+            uint8_t stored[4];
+            uint64_t rawSize = 0, packedSize = 0;
+            if (!readVarint(in, rawSize)) return readOk = false;
+            if (rawSize == 0) {
+                ended = true;
+                return false;
+            }
+            if (!readVarint(in, packedSize) || rawSize > MAX_BLOCK_SIZE || packedSize > 2 * MAX_BLOCK_SIZE ||
+                !in.read(reinterpret_cast<char*>(stored), sizeof(stored))) {
+                return readOk = false;
+            }
+            job.id = checksums.size();
+            checksums.push_back(getU32(stored));
+            job.packed.resize(packedSize);
+            job.raw.resize(rawSize);
+            readOk = static_cast<bool>(in.read(reinterpret_cast<char*>(job.packed.data()), packedSize));
+            return readOk;
+        },
+        [&](BlockJob &job) {
+            if (job.checksum != checksums[job.id]) return false;
+            fileChecksum = crc32cCombine(fileChecksum, job.checksum, job.raw.size());
+            totalSize += job.raw.size();
+            out.write(reinterpret_cast<const char*>(job.raw.data()), job.raw.size());
+            return true;
+        }, dictionary, memoryLimit);
+    if (!ok || !readOk || !ended) return false;
+    if (info.flags & FLAG_SINGLE_BLOCK) {
+        out.flush();
+        return checksums.size() <= 1 && out;
+    }
+    
+    // The index repeats each block's checksum, followed by the footer
+    vector<uint8_t> tail(checksums.size() * INDEX_ENTRY_SIZE + INDEX_FOOTER_SIZE);
+    if (!in.read(reinterpret_cast<char*>(tail.data()), tail.size())) return false;
+    const uint8_t *footer = tail.data() + checksums.size() * INDEX_ENTRY_SIZE;
+    if (getU32(footer + 8) != checksums.size() || getU64(footer + 12) != totalSize ||
+        getU32(footer + 20) != fileChecksum || getU32(footer + 24) != INDEX_MAGIC) {
+        return false;
+    }
+    for (size_t i = 0; i < checksums.size(); i++) {
+        if (getU32(tail.data() + i * INDEX_ENTRY_SIZE + 16) != checksums[i]) return false;
+    }
+    out.flush();
+    return static_cast<bool>(out);
+}
+
+// Decompress an indexed file, decoding blocks in parallel; the per-block checksums are
+// folded in file order and compared with the whole-file checksum from the footer
+bool decompressIndexed(istream &in, const vector<BlockIndexEntry> &index, const ContainerInfo &info,
+                       ostream &out, unsigned threads, const Dictionary *dictionary = nullptr,
+                       size_t memoryLimit = 0) {
+    if (!checkDictionary(info, dictionary)) return false;
+    uint32_t checksum = 0;
+    bool ok = decodeIndexedBlocks(in, index, 0, index.size(), threads, dictionary, memoryLimit,
+        [&](const BlockIndexEntry &entry, const vector<uint8_t> &raw) {
+            checksum = crc32cCombine(checksum, entry.checksum, entry.rawSize);
+            out.write(reinterpret_cast<const char*>(raw.data()), raw.size());
+        });
+    out.flush();
+    return ok && checksum == info.checksum && out;
 }
 
 // Decompress file using Huffman coding
-void decompressFile(const string &inputFile, const string &outputFile) {
+[[maybe_unused]] void decompressFile(const string &inputFile, const string &outputFile, unsigned threads = defaultThreadCount()) {
     ifstream inFile(inputFile, ios::binary);
+    vector<BlockIndexEntry> index;
+    ContainerInfo info;
+    if (!inFile || !readBlockIndex(inFile, index, info)) {
+        cerr << "Error: missing or corrupt block index in " << inputFile << endl;
+        return;
+    }
+    if (!checkDictionary(info, nullptr)) return;
+    ofstream outFile(outputFile, ios::binary);
+    bool ok = decompressIndexed(inFile, index, info, outFile, threads);
+    outFile.close();
+    
+    if (!ok) {
+        cerr << "Error: corrupt block in " << inputFile << endl;
+        return;
+    }
+    cout << "File decompressed successfully!" << endl;
+}
+
+// Extract `length` bytes starting at `offset` of the original data, decoding only
+// the blocks that overlap the range
+[[maybe_unused]] void extractRange(const string &inputFile, const string &outputFile, uint64_t offset, uint64_t length,
+                  unsigned threads = defaultThreadCount()) {
+    ifstream inFile(inputFile, ios::binary);
+    vector<BlockIndexEntry> index;
+    ContainerInfo info;
+    if (!inFile || !readBlockIndex(inFile, index, info)) {
+        cerr << "Error: missing or corrupt block index in " << inputFile << endl;
+        return;
+    }
+    if (!checkDictionary(info, nullptr)) return;
+    uint64_t totalSize = index.empty() ? 0 : index.back().rawOffset + index.back().rawSize;
+    if (offset > totalSize) offset = totalSize;
+    uint64_t end = offset + min(length, totalSize - offset);
+    
+    // First block ending after `offset`, and first block starting at or after `end`
+    auto firstBlock = upper_bound(index.begin(), index.end(), offset,
+        [](uint64_t value, const BlockIndexEntry &e) { return value < e.rawOffset + e.rawSize; });
+    auto lastBlock = lower_bound(firstBlock, index.end(), end,
+        [](const BlockIndexEntry &e, uint64_t value) { return e.rawOffset < value; });
+    
     ofstream outFile(outputFile, ios::binary);
+    bool ok = decodeIndexedBlocks(inFile, index, firstBlock - index.begin(), lastBlock - index.begin(), threads, nullptr, 0,
+        [&](const BlockIndexEntry &entry, const vector<uint8_t> &raw) {
+            uint64_t from = max(offset, entry.rawOffset) - entry.rawOffset;
+            uint64_t to = min(end, entry.rawOffset + entry.rawSize) - entry.rawOffset;
+            outFile.write(reinterpret_cast<const char*>(raw.data() + from), to - from);
+        });
+    outFile.close();
+    
+    if (!ok) {
+        cerr << "Error: corrupt block in " << inputFile << endl;
+        return;
+    }
+    cout << "Extracted " << end - offset << " bytes successfully!" << endl;
+}
+
+// Batch archive: "HUFA", version, flags (0), then each file as a complete compressed
+// container, then the central directory and a fixed-size footer
+const uint8_t ARCHIVE_MAGIC[4] = {'H', 'U', 'F', 'A'};
+const uint8_t ARCHIVE_VERSION = 1;
+const size_t ARCHIVE_HEADER_SIZE = 6;
+const size_t ARCHIVE_FOOTER_SIZE = 20;
+const uint32_t DIRECTORY_MAGIC = 0x52444348; // "HCDR"
+
+// One file in the central directory
+struct ArchiveEntry {
+    string name;         // Path relative to the archived directory, '/'-separated
+    uint64_t offset;     // Archive offset of the member's container
+    uint64_t packedSize; // Size of the member's container
+    uint64_t rawSize;
+    uint32_t checksum;   // CRC32C of the original file
+};
+
+// Central directory: per entry the name length and name, offset, sizes (varints) and
+// checksum; then the footer: directory offset, entry count, CRC32C of the directory
+void writeArchiveDirectory(ostream &out, const vector<ArchiveEntry> &entries, uint64_t directoryOffset) {
+    vector<uint8_t> bytes;
+    for (const auto &entry : entries) {
+        writeVarint(bytes, entry.name.size());
+        bytes.insert(bytes.end(), entry.name.begin(), entry.name.end());
+        writeVarint(bytes, entry.offset);
+        writeVarint(bytes, entry.packedSize);
+        writeVarint(bytes, entry.rawSize);
+        putU32(bytes, entry.checksum);
+    }
+    uint32_t directoryChecksum = crc32c(bytes.data(), bytes.size());
+    putU64(bytes, directoryOffset);
+    putU32(bytes, static_cast<uint32_t>(entries.size()));
+    putU32(bytes, directoryChecksum);
+    putU32(bytes, DIRECTORY_MAGIC);
+    out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+bool readArchiveDirectory(istream &in, vector<ArchiveEntry> &entries) {
+    uint8_t header[ARCHIVE_HEADER_SIZE];
+    in.seekg(0);
+    if (!in.read(reinterpret_cast<char*>(header), sizeof(header)) || memcmp(header, ARCHIVE_MAGIC, 4) != 0 ||
+        header[4] != ARCHIVE_VERSION || header[5] != 0) {
+        return false;
+    }
+    in.seekg(0, ios::end);
+    uint64_t fileSize = static_cast<uint64_t>(in.tellg());
+    if (!in || fileSize < ARCHIVE_HEADER_SIZE + ARCHIVE_FOOTER_SIZE) return false;
+    uint8_t footer[ARCHIVE_FOOTER_SIZE];
+    in.seekg(fileSize - ARCHIVE_FOOTER_SIZE);
+    if (!in.read(reinterpret_cast<char*>(footer), sizeof(footer)) || getU32(footer + 16) != DIRECTORY_MAGIC) {
+        return false;
+    }
+    uint64_t directoryOffset = getU64(footer);
+    uint32_t count = getU32(footer + 8);
+    if (directoryOffset < ARCHIVE_HEADER_SIZE || directoryOffset > fileSize - ARCHIVE_FOOTER_SIZE) return false;
     
-    // Read header (frequency map)
-    int size;
-    inFile >> size;
-    inFile.ignore(); // Skip newline
+    vector<uint8_t> bytes(fileSize - ARCHIVE_FOOTER_SIZE - directoryOffset);
+    in.seekg(directoryOffset);
+    if (!in.read(reinterpret_cast<char*>(bytes.data()), bytes.size()) ||
+        crc32c(bytes.data(), bytes.size()) != getU32(footer + 12)) {
+        return false;
+    }
+    entries.clear();
+    size_t pos = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        ArchiveEntry entry;
+        uint64_t nameSize = 0;
+        if (!readVarint(bytes.data(), bytes.size(), pos, nameSize) || nameSize > bytes.size() - pos) return false;
+        entry.name.assign(reinterpret_cast<const char*>(bytes.data() + pos), static_cast<size_t>(nameSize));
+        pos += static_cast<size_t>(nameSize);
+        if (!readVarint(bytes.data(), bytes.size(), pos, entry.offset) ||
+            !readVarint(bytes.data(), bytes.size(), pos, entry.packedSize) ||
+            !readVarint(bytes.data(), bytes.size(), pos, entry.rawSize) || bytes.size() - pos < 4 ||
+            entry.offset < ARCHIVE_HEADER_SIZE || entry.packedSize > directoryOffset - entry.offset) {
+            return false;
+        }
+        entry.checksum = getU32(bytes.data() + pos);
+        pos += 4;
+        entries.push_back(move(entry));
+    }
+    return pos == bytes.size();
+}
+
+// A file being compressed by compressDirectory. A file of one block is coded by a single
+// job and written whole; a larger one streams its blocks through a window of block jobs,
+// written to its own output in order as the oldest ones finish.
+struct BatchFile {
+    filesystem::path path;
+    string name;
+    uint64_t size = 0;
+    unique_ptr<InputSource> input;
+    vector<unique_ptr<BlockJob>> blocks; // Single-job files: every block, written at the end
     
-    unordered_map<char, unsigned> freqMap;
-    for (int i = 0; i < size; i++) {
-        int ch;
-        unsigned freq;
-        inFile >> ch >> freq;
-        inFile.ignore(); // Skip newline
-        freqMap[static_cast<char>(ch)] = freq;
+    mutex lock;                          // Guards the window state below
+    deque<unique_ptr<BlockJob>> window;  // Blocks read but not yet written, in file order
+    unique_ptr<ofstream> out;
+    unique_ptr<ContainerWriter> writer;
+    bool inputEnded = false, written = false;
+};
+
+// Compress every regular file under `root` on a work-stealing pool, either to
+// `<file>.huf` beside each file or, when `archivePath` is given, into one archive.
+// Files are scheduled largest first; a file of one block is a single job, while a
+// larger file spawns a job per block, at most two per worker at a time. An archive is
+// written front to back, so its larger files are streamed into it after the pool drains.
+int compressDirectory(const string &root, const string &archivePath, const CompressionOptions &options) {
+    vector<unique_ptr<BatchFile>> files;
+    error_code error;
+    filesystem::path archive = archivePath.empty() ? filesystem::path() : filesystem::absolute(archivePath, error);
+    for (filesystem::recursive_directory_iterator it(root, filesystem::directory_options::skip_permission_denied, error), end;
+         !error && it != end; it.increment(error)) {
+        if (!it->is_regular_file(error)) continue;
+        const filesystem::path &path = it->path();
+        if (archive.empty() ? path.extension() == ".huf" : filesystem::equivalent(path, archive, error)) continue;
+        unique_ptr<BatchFile> file(new BatchFile);
+        file->path = path;
+        file->name = path.lexically_relative(root).generic_string();
+        file->size = it->file_size(error);
+        files.push_back(move(file));
     }
+    if (error) {
+        cerr << "Error reading directory " << root << ": " << error.message() << endl;
+        return 1;
+    }
+    sort(files.begin(), files.end(), [](const unique_ptr<BatchFile> &a, const unique_ptr<BatchFile> &b) {
+        return a->size > b->size;
+    });
     
-    // Read padding
-    int padding;
-    inFile >> padding;
-    inFile.ignore(); // Skip newline
+    ofstream archiveFile;
+    uint64_t archiveSize = ARCHIVE_HEADER_SIZE;
+    vector<ArchiveEntry> entries;
+    mutex outputLock;
+    if (!archivePath.empty()) {
+        archiveFile.open(archivePath, ios::binary);
+        uint8_t header[ARCHIVE_HEADER_SIZE] = {ARCHIVE_MAGIC[0], ARCHIVE_MAGIC[1], ARCHIVE_MAGIC[2], ARCHIVE_MAGIC[3],
+                                               ARCHIVE_VERSION, 0};
+        archiveFile.write(reinterpret_cast<const char*>(header), sizeof(header));
+        if (!archiveFile) {
+            cerr << "Error opening file: " << archivePath << endl;
+            return 1;
+        }
+    }
     
-    // Rebuild Huffman Tree
-    HuffmanNode* root = buildHuffmanTree(freqMap);
+    atomic<bool> failed(false);
+    uint64_t totalRaw = 0, totalPacked = 0;
+    // Account for a finished file; the caller holds outputLock
+    auto recordFile = [&](const BatchFile &file, const CompressionStats &stats, bool ok) {
+        if (!ok) {
+            cerr << "Error writing file: " << (archiveFile.is_open() ? archivePath : file.path.string() + ".huf") << endl;
+            failed = true;
+        }
+        if (archiveFile.is_open()) {
+            entries.push_back({file.name, archiveSize, stats.compressedSize, stats.originalSize, stats.checksum});
+            archiveSize += stats.compressedSize;
+        }
+        totalRaw += stats.originalSize;
+        totalPacked += stats.compressedSize;
+    };
+    auto writeFile = [&](BatchFile &file) {
+        if (archiveFile.is_open()) {
+            lock_guard<mutex> guard(outputLock);
+            ContainerWriter writer(archiveFile, options);
+            writer.begin(file.blocks.size() <= 1);
+            for (const auto &block : file.blocks) writer.addBlock(block->inputSize, block->checksum, block->packed);
+            recordFile(file, writer.stats, writer.finish());
+        } else {
+            ofstream out(file.path.string() + ".huf", ios::binary);
+            ContainerWriter writer(out, options);
+            writer.begin(file.blocks.size() <= 1);
+            for (const auto &block : file.blocks) writer.addBlock(block->inputSize, block->checksum, block->packed);
+            bool ok = writer.finish();
+            lock_guard<mutex> guard(outputLock);
+            recordFile(file, writer.stats, ok);
+        }
+        file.blocks.clear();
+        file.input.reset();
+    };
     
-    // Read compressed data
-    string encodedStr = "";
-    char byte;
-    while (inFile.get(byte)) {
-        encodedStr += bitset<8>(byte).to_string();
+    // Under a memory limit, only as many workers as there are blocks' worth of budget,
+    // and files of several blocks are streamed afterwards, one at a time
+    unsigned threads = options.threads;
+    if (size_t budget = blockMemoryBudget(options.memoryLimit)) {
+        size_t fitting = max<size_t>(budget / compressionBlockMemory(options.blockSize, options), 1);
+        threads = static_cast<unsigned>(min<size_t>(threads, fitting));
     }
-    inFile.close();
+    bool streamLater = options.memoryLimit || archiveFile.is_open();
+    WorkStealingPool pool(threads);
+    size_t maxInFlight = 2 * pool.size();
+    auto compress = [&options](BlockJob &block) {
+        block.checksum = crc32c(block.input, block.inputSize);
+        compressBlock(block.input, block.inputSize, options, block.packed);
+        block.raw = vector<uint8_t>();
+    };
+    
+    // Write the finished blocks at the front of a file's window, then refill it; run
+    // after the file is opened and after each of its block jobs
+    function<void(BatchFile *)> advance = [&](BatchFile *file) {
+        lock_guard<mutex> guard(file->lock);
+        while (!file->window.empty() && file->window.front()->coded) {
+            const BlockJob &block = *file->window.front();
+            if (!file->writer->hasStarted()) file->writer->begin(file->inputEnded && file->window.size() <= 1);
+            file->writer->addBlock(block.inputSize, block.checksum, block.packed);
+            file->input->release(block.input, block.inputSize);
+            file->window.pop_front();
+        }
+        while (!file->inputEnded && file->window.size() < maxInFlight) {
+            unique_ptr<BlockJob> block(new BlockJob);
+            block->inputSize = file->input->next(options.blockSize, block->raw, block->input);
+            file->inputEnded = block->inputSize == 0 || file->input->atEnd();
+            if (block->inputSize == 0) break;
+            BlockJob *job = block.get();
+            file->window.push_back(move(block));
+            pool.submit([&, file, job] {
+                compress(*job);
+                {
+                    lock_guard<mutex> guard(file->lock);
+                    job->coded = true;
+                }
+                advance(file);
+            });
+        }
+        if (file->inputEnded && file->window.empty() && !file->written) {
+            file->written = true;
+            if (!file->writer->hasStarted()) file->writer->begin(true);
+            bool ok = file->writer->finish();
+            file->out.reset();
+            file->input.reset();
+            lock_guard<mutex> outputGuard(outputLock);
+            recordFile(*file, file->writer->stats, ok);
+        }
+    };
     
-    // Remove padding
-    encodedStr = encodedStr.substr(0, encodedStr.length() - padding);
+    for (auto &entry : files) {
+        BatchFile *file = entry.get();
+        bool severalBlocks = file->size > options.blockSize;
+        if (streamLater && severalBlocks) continue;
+        pool.submit([&, file, severalBlocks] {
+            file->input.reset(new InputSource);
+            if (!file->input->open(file->path.string())) {
+                lock_guard<mutex> guard(outputLock);
+                cerr << "Error opening file: " << file->path.string() << endl;
+                failed = true;
+                return;
+            }
+            if (severalBlocks) {
+                file->out.reset(new ofstream(file->path.string() + ".huf", ios::binary));
+                file->writer.reset(new ContainerWriter(*file->out, options));
+                advance(file);
+                return;
+            }
+            while (true) {
+                unique_ptr<BlockJob> block(new BlockJob);
+                block->inputSize = file->input->next(options.blockSize, block->raw, block->input);
+                if (block->inputSize == 0) break;
+                compress(*block);
+                file->blocks.push_back(move(block));
+            }
+            writeFile(*file);
+        });
+    }
+    pool.wait();
     
-    // Decode using Huffman Tree
-    HuffmanNode* current = root;
-    for (char bit : encodedStr) {
-        if (bit == '0') {
-            current = current->left;
+    for (auto &entry : files) {
+        BatchFile &file = *entry;
+        if (!streamLater || file.size <= options.blockSize) continue;
+        InputSource input;
+        if (!input.open(file.path.string())) {
+            cerr << "Error opening file: " << file.path.string() << endl;
+            failed = true;
+            continue;
+        }
+        CompressionStats stats;
+        if (archiveFile.is_open()) {
+            recordFile(file, stats, compressStream(input, archiveFile, options, stats));
         } else {
-            current = current->right;
+            ofstream out(file.path.string() + ".huf", ios::binary);
+            recordFile(file, stats, compressStream(input, out, options, stats));
         }
-        
-        if (current->left == nullptr && current->right == nullptr) {
-            outFile.put(current->data);
-            current = root;
+    }
+    
+    if (archiveFile.is_open()) {
+        sort(entries.begin(), entries.end(), [](const ArchiveEntry &a, const ArchiveEntry &b) { return a.name < b.name; });
+        writeArchiveDirectory(archiveFile, entries, archiveSize);
+        archiveFile.close();
+        if (!archiveFile) {
+            cerr << "Error writing file: " << archivePath << endl;
+            return 1;
         }
     }
+    cerr << files.size() << " files, " << totalRaw << " -> " << totalPacked << " bytes" << endl;
+    return failed ? 1 : 0;
+}
+
+// Whether an archive member name stays inside the extraction directory
+bool isSafeMemberName(const string &name) {
+    filesystem::path path(name);
+    if (name.empty() || path.has_root_path()) return false;
+    for (const auto &part : path) {
+        if (part == ".." || part == ".") return false;
+    }
+    return true;
+}
+
+// Extract every member of an archive below `outputDir`, one job per member; large
+// members also decode their blocks in parallel
+int extractArchive(const string &archivePath, const string &outputDir, const CompressionOptions &options) {
+    ifstream in(archivePath, ios::binary);
+    vector<ArchiveEntry> entries;
+    if (!in || !readArchiveDirectory(in, entries)) {
+        cerr << "Error: missing or corrupt archive directory in " << archivePath << endl;
+        return 1;
+    }
+    atomic<bool> failed(false);
+    mutex errorLock;
+    auto report = [&](const string &message) {
+        lock_guard<mutex> guard(errorLock);
+        cerr << message << endl;
+        failed = true;
+    };
     
-    outFile.close();
-    cout << "File decompressed successfully!" << endl;
+    // Under a memory limit, each worker's member gets an equal share of the budget
+    WorkStealingPool pool(options.threads);
+    size_t memberLimit = options.memoryLimit ? MEMORY_RESERVE + blockMemoryBudget(options.memoryLimit) / pool.size() : 0;
+    for (const auto &entry : entries) {
+        pool.submit([&, entry] {
+            if (!isSafeMemberName(entry.name)) {
+                report("Error: unsafe member name " + entry.name);
+                return;
+            }
+            filesystem::path target = filesystem::path(outputDir) / filesystem::path(entry.name);
+            error_code error;
+            filesystem::create_directories(target.parent_path(), error);
+            ifstream member(archivePath, ios::binary);
+            ofstream out(target, ios::binary);
+            if (!member || !out) {
+                report("Error opening file: " + target.string());
+                return;
+            }
+            member.seekg(entry.offset);
+            unsigned threads = entry.rawSize > options.blockSize ? options.threads : 1;
+            if (!decompressStream(member, out, threads, options.dictionary, memberLimit) ||
+                static_cast<uint64_t>(member.tellg()) != entry.offset + entry.packedSize) {
+                report("Error: corrupt member " + entry.name);
+            }
+        });
+    }
+    pool.wait();
+    cerr << entries.size() << " files extracted" << endl;
+    return failed ? 1 : 0;
+}
+
+// Decompress every `.huf` file under `root` beside itself, without the suffix
+int decompressDirectory(const string &root, const CompressionOptions &options) {
+    vector<filesystem::path> files;
+    error_code error;
+    for (filesystem::recursive_directory_iterator it(root, filesystem::directory_options::skip_permission_denied, error), end;
+         !error && it != end; it.increment(error)) {
+        if (it->is_regular_file(error) && it->path().extension() == ".huf") files.push_back(it->path());
+    }
+    if (error) {
+        cerr << "Error reading directory " << root << ": " << error.message() << endl;
+        return 1;
+    }
+    atomic<bool> failed(false);
+    mutex errorLock;
+    WorkStealingPool pool(options.threads);
+    size_t fileLimit = options.memoryLimit ? MEMORY_RESERVE + blockMemoryBudget(options.memoryLimit) / pool.size() : 0;
+    for (const auto &path : files) {
+        pool.submit([&, path] {
+            ifstream in(path, ios::binary);
+            vector<BlockIndexEntry> index;
+            ContainerInfo info;
+            bool ok = in && readBlockIndex(in, index, info);
+            if (ok) {
+                filesystem::path target = path;
+                target.replace_extension();
+                ofstream out(target, ios::binary);
+                ok = decompressIndexed(in, index, info, out, 1, options.dictionary, fileLimit);
+            }
+            if (!ok) {
+                lock_guard<mutex> guard(errorLock);
+                cerr << "Error: corrupt or unreadable " << path.string() << endl;
+                failed = true;
+            }
+        });
+    }
+    pool.wait();
+    cerr << files.size() << " files decompressed" << endl;
+    return failed ? 1 : 0;
 }
 
 // Display menu
-void displayMenu() {
+[[maybe_unused]] void displayMenu() {
     cout << "\n📁 File Compression Tool" << endl;
     cout << "=======================" << endl;
     cout << "1. Compress File" << endl;
     cout << "2. Decompress File" << endl;
-    cout << "3. Exit" << endl;
-    cout << "Enter your choice (1-3): ";
+    cout << "3. Extract Byte Range" << endl;
+    cout << "4. Exit" << endl;
+    cout << "Enter your choice (1-4): ";
+}
+
+// Measure what each Huffman code length limit costs in ratio and gains in decode speed,
+// using the Huffman-only coder on (up to 256 MB of) a sample file
+int benchmarkCodeLengthLimits(const string &inputFile) {
+    InputSource input;
+    if (!input.open(inputFile)) {
+        cerr << "Error opening file: " << inputFile << endl;
+        return 1;
+    }
+    vector<vector<uint8_t>> blocks;
+    size_t total = 0;
+    while (total < (size_t(256) << 20)) {
+        vector<uint8_t> storage;
+        const uint8_t *data;
+        size_t n = input.next(DEFAULT_BLOCK_SIZE, storage, data);
+        if (n == 0) break;
+        blocks.emplace_back(data, data + n);
+        total += n;
+    }
+    if (total == 0) {
+        cerr << "Error: " << inputFile << " is empty" << endl;
+        return 1;
+    }
+    
+    cout << left << setw(8) << "Limit" << setw(16) << "Compressed" << setw(10) << "Ratio"
+         << setw(14) << "Cost vs opt" << "Decode MB/s" << endl;
+    size_t optimalSize = 0;
+    for (int limit : {0, 15, 13, 12, 11, 10, 9}) {
+        vector<vector<uint8_t>> packed(blocks.size());
+        size_t packedSize = 0;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            encodeHuffman(blocks[i].data(), blocks[i].size(), packed[i], limit);
+            packedSize += packed[i].size();
+        }
+        if (limit == 0) optimalSize = packedSize;
+        
+        // Best of three timed passes over every block
+        vector<uint8_t> raw(DEFAULT_BLOCK_SIZE);
+        double best = 1e30;
+        for (int pass = 0; pass < 3; pass++) {
+            auto start = chrono::steady_clock::now();
+            for (size_t i = 0; i < blocks.size(); i++) {
+                decodeHuffman(packed[i].data(), packed[i].size(), raw.data(), blocks[i].size());
+            }
+            best = min(best, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+        }
+        
+        cout << setw(8) << (limit ? to_string(limit) : string("none")) << setw(16) << packedSize
+             << setw(10) << fixed << setprecision(3) << double(total) / packedSize
+             << setw(14) << (to_string((double(packedSize) / optimalSize - 1) * 100).substr(0, 5) + "%")
+             << setprecision(0) << total / best / 1e6 << endl;
+    }
+    return 0;
+}
+
+// Peak resident set size of this process in KB, or 0 where the platform does not report it
+size_t peakResidentKb() {
+#ifdef __linux__
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) return strtoul(line.c_str() + 6, nullptr, 10);
+    }
+#endif
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss) / 1024;
+#else
+    return static_cast<size_t>(usage.ru_maxrss);
+#endif
+#else
+    return 0;
+#endif
+}
+
+// Restart peak RSS tracking so each benchmark run reports its own peak (Linux only;
+// elsewhere the figure is the peak of the whole process so far)
+void resetPeakResident() {
+#ifdef __linux__
+    ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+#endif
+}
+
+// Small deterministic generator so the benchmark corpus is identical between versions
+struct BenchRandom {
+    uint64_t state;
+    explicit BenchRandom(uint64_t seed) : state(seed) {}
+    
+    uint64_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+    
+    uint32_t below(uint32_t bound) { return static_cast<uint32_t>(next() % bound); }
+};
+
+// Words with a skewed distribution, as in logs and prose
+string benchWord(BenchRandom &rng) {
+    static const char *const words[] = {
+        "the", "request", "user", "session", "cache", "miss", "hit", "error", "timeout", "connection",
+        "retry", "server", "client", "query", "index", "update", "record", "value", "started", "finished",
+        "failed", "ok", "latency", "bytes", "worker", "queue", "commit", "rollback", "checkpoint", "shard"};
+    const uint32_t count = sizeof(words) / sizeof(words[0]);
+    return words[min(rng.below(count), rng.below(count))];
+}
+
+// Log-style text lines
+vector<uint8_t> benchText(size_t size, uint64_t seed) {
+    BenchRandom rng(seed);
+    static const char *const levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+    string text;
+    uint64_t clock = 1700000000000ull;
+    while (text.size() < size) {
+        clock += rng.below(5000);
+        text += to_string(clock) + " " + levels[rng.below(6)] + " [worker-" + to_string(rng.below(16)) + "] ";
+        int words = 3 + rng.below(10);
+        for (int w = 0; w < words; w++) text += benchWord(rng) + " ";
+        text += "id=" + to_string(rng.below(100000)) + " time=" + to_string(rng.below(2000)) + "ms\n";
+    }
+    text.resize(size);
+    return vector<uint8_t>(text.begin(), text.end());
+}
+
+// Fixed-size little-endian records: counters, small enums, a random walk and timestamps
+vector<uint8_t> benchBinary(size_t size, uint64_t seed) {
+    BenchRandom rng(seed);
+    vector<uint8_t> data;
+    data.reserve(size + 32);
+    uint64_t timestamp = 1700000000000000ull;
+    double value = 100.0;
+    for (uint32_t id = 0; data.size() < size; id++) {
+        timestamp += 1000 + rng.below(64);
+        value += (static_cast<double>(rng.below(2001)) - 1000.0) / 1000.0;
+        uint64_t valueBits;
+        memcpy(&valueBits, &value, sizeof(valueBits));
+        putU32(data, id);
+        putU32(data, rng.below(8));
+        putU64(data, valueBits);
+        putU64(data, timestamp);
+        putU32(data, rng.below(100) == 0 ? rng.below(1u << 16) : 0);
+        putU32(data, 0);
+    }
+    data.resize(size);
+    return data;
+}
+
+vector<uint8_t> benchRandom(size_t size, uint64_t seed) {
+    BenchRandom rng(seed);
+    vector<uint8_t> data(size);
+    for (auto &byte : data) byte = static_cast<uint8_t>(rng.next() >> 56);
+    return data;
+}
+
+// A 1-4 KB JSON record, like the small-file workload
+vector<uint8_t> benchRecord(BenchRandom &rng) {
+    size_t target = 1024 + rng.below(3072);
+    string json = "{\"id\":" + to_string(rng.below(1000000)) + ",\"events\":[";
+    while (json.size() < target) {
+        if (json.back() == '}') json += ",";
+        json += "{\"type\":\"" + benchWord(rng) + "\",\"status\":\"" + benchWord(rng) +
+                "\",\"elapsed_ms\":" + to_string(rng.below(5000)) + ",\"ok\":" +
+                (rng.below(4) ? "true" : "false") + "}";
+    }
+    json += "]}";
+    return vector<uint8_t>(json.begin(), json.end());
+}
+
+// One benchmark input: a single large buffer, or many small files coded independently
+struct BenchCorpus {
+    string name;
+    vector<vector<uint8_t>> files;
+    shared_ptr<Dictionary> dictionary; // Trained on other samples of the same kind, if set
+};
+
+vector<BenchCorpus> buildBenchCorpus(size_t size) {
+    vector<BenchCorpus> corpus;
+    corpus.push_back({"text", {benchText(size, 1)}, nullptr});
+    corpus.push_back({"binary", {benchBinary(size, 2)}, nullptr});
+    corpus.push_back({"random", {benchRandom(size, 3)}, nullptr});
+    corpus.push_back({"same-byte", {vector<uint8_t>(size, 'a')}, nullptr});
+    
+    BenchCorpus small = {"small-files", {}, nullptr};
+    BenchRandom rng(5);
+    size_t total = 0;
+    while (total < size / 8) {
+        small.files.push_back(benchRecord(rng));
+        total += small.files.back().size();
+    }
+    
+    // The same records again, with a dictionary trained on a disjoint set
+    BenchRandom trainRng(6);
+    vector<vector<uint8_t>> samples(small.files.size());
+    for (auto &sample : samples) sample = benchRecord(trainRng);
+    BenchCorpus smallDict = {"small-files-dict", small.files, make_shared<Dictionary>()};
+    parseDictionary(trainDictionary(samples, CompressionOptions()), *smallDict.dictionary);
+    corpus.push_back(move(small));
+    corpus.push_back(move(smallDict));
+    return corpus;
+}
+
+// Compress every file of a corpus in memory
+bool benchCompress(const BenchCorpus &corpus, const CompressionOptions &options, vector<string> &packed) {
+    packed.resize(corpus.files.size());
+    for (size_t i = 0; i < corpus.files.size(); i++) {
+        InputSource input;
+        input.openMemory(corpus.files[i].data(), corpus.files[i].size());
+        ostringstream out;
+        CompressionStats stats;
+        if (!compressStream(input, out, options, stats)) return false;
+        packed[i] = out.str();
+    }
+    return true;
+}
+
+// Decompress every file of a corpus in memory and check it against the original
+bool benchDecompress(const BenchCorpus &corpus, const vector<string> &packed, unsigned threads) {
+    for (size_t i = 0; i < packed.size(); i++) {
+        istringstream in(packed[i]);
+        ostringstream out;
+        vector<BlockIndexEntry> index;
+        ContainerInfo info;
+        if (!readBlockIndex(in, index, info) ||
+            !decompressIndexed(in, index, info, out, threads, corpus.dictionary.get())) {
+            return false;
+        }
+        const string raw = out.str();
+        if (raw.size() != corpus.files[i].size() || memcmp(raw.data(), corpus.files[i].data(), raw.size()) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Time compression and decompression of a synthetic corpus at several levels and thread
+// counts, printing one JSON object so results can be compared between versions
+int benchmarkCorpus(size_t corpusSize) {
+    const int runs = 3;
+    vector<BenchCorpus> corpus = buildBenchCorpus(corpusSize);
+    vector<unsigned> threadCounts = {1};
+    if (defaultThreadCount() > 1) threadCounts.push_back(defaultThreadCount());
+    
+    cout << "{\n  \"format_version\": " << int(FORMAT_VERSION) << ",\n  \"corpus_bytes\": " << corpusSize
+         << ",\n  \"hardware_threads\": " << defaultThreadCount() << ",\n  \"results\": [";
+    bool first = true;
+    for (const auto &input : corpus) {
+        size_t rawSize = 0;
+        for (const auto &file : input.files) rawSize += file.size();
+        
+        // Levels 0-9, then the densest mode: level 9 with order-1 context modeling
+        for (int mode : {0, 1, 3, 6, 9, 10}) {
+            int level = min(mode, 9);
+            for (unsigned threads : threadCounts) {
+                CompressionOptions options;
+                options.level = level;
+                options.contextModel = mode == 10;
+                options.threads = threads;
+                options.dictionary = input.dictionary.get();
+                
+                // Best of several runs for each direction; the peak covers all of them
+                resetPeakResident();
+                vector<string> packed;
+                double compressTime = 1e30, decompressTime = 1e30;
+                for (int run = 0; run < runs; run++) {
+                    auto start = chrono::steady_clock::now();
+                    if (!benchCompress(input, options, packed)) {
+                        cerr << "Error: compression failed for " << input.name << endl;
+                        return 1;
+                    }
+                    compressTime = min(compressTime, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+                }
+                for (int run = 0; run < runs; run++) {
+                    auto start = chrono::steady_clock::now();
+                    if (!benchDecompress(input, packed, threads)) {
+                        cerr << "Error: round trip failed for " << input.name << " at level " << level << endl;
+                        return 1;
+                    }
+                    decompressTime = min(decompressTime, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+                }
+                size_t packedSize = 0;
+                for (const auto &file : packed) packedSize += file.size();
+                
+                cout << (first ? "\n" : ",\n") << fixed << setprecision(3)
+                     << "    {\"corpus\": \"" << input.name << "\", \"files\": " << input.files.size()
+                     << ", \"level\": " << level << ", \"context_model\": " << (options.contextModel ? "true" : "false")
+                     << ", \"threads\": " << threads
+                     << ", \"raw_bytes\": " << rawSize << ", \"compressed_bytes\": " << packedSize
+                     << ", \"ratio\": " << double(rawSize) / max<size_t>(packedSize, 1)
+                     << ", \"compress_mb_s\": " << setprecision(1) << rawSize / compressTime / 1e6
+                     << ", \"decompress_mb_s\": " << rawSize / decompressTime / 1e6
+                     << ", \"peak_rss_kb\": " << peakResidentKb() << "}";
+                first = false;
+            }
+        }
+    }
+    cout << "\n  ]\n}" << endl;
+    return 0;
+}
+
+// Train a dictionary on sample files and write it to `dictionaryFile`
+int trainCommand(const string &dictionaryFile, const vector<string> &sampleFiles) {
+    vector<vector<uint8_t>> samples;
+    for (const auto &name : sampleFiles) {
+        ifstream in(name, ios::binary);
+        if (!in) {
+            cerr << "Error opening file: " << name << endl;
+            return 1;
+        }
+        samples.emplace_back(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+    vector<uint8_t> file = trainDictionary(samples, CompressionOptions());
+    ofstream out(dictionaryFile, ios::binary);
+    out.write(reinterpret_cast<const char*>(file.data()), file.size());
+    if (!out) {
+        cerr << "Error writing dictionary: " << dictionaryFile << endl;
+        return 1;
+    }
+    Dictionary dictionary;
+    parseDictionary(file, dictionary);
+    cerr << "Dictionary " << hex << setw(8) << setfill('0') << dictionary.id << dec << setfill(' ') << ": "
+         << dictionary.content.size() << " bytes of history from " << samples.size() << " samples" << endl;
+    return 0;
+}
+
+// Self-checks for behaviour the output bytes alone do not show; prints each result and
+// returns nonzero if any fails
+int selfTest() {
+    bool allOk = true;
+    auto report = [&](const string &name, bool ok, const string &detail) {
+        cerr << (ok ? "ok    " : "FAIL  ") << name << (detail.empty() ? "" : ": " + detail) << endl;
+        allOk = allOk && ok;
+    };
+    auto joined = [](const vector<string> &items) {
+        string text;
+        for (const auto &item : items) text += (text.empty() ? "" : " ") + item;
+        return text;
+    };
+    
+    // Work-stealing pool order: submissions run first-in first-out, so compressDirectory's
+    // largest-first ordering holds; jobs spawned by a worker run before older submissions.
+    // One worker is held at a gate until everything is queued, making the order exact.
+    {
+        WorkStealingPool pool(1);
+        mutex orderLock;
+        vector<string> order;
+        auto record = [&](const string &name) {
+            lock_guard<mutex> guard(orderLock);
+            order.push_back(name);
+        };
+        promise<void> gate;
+        shared_future<void> opened = gate.get_future().share();
+        pool.submit([opened] { opened.wait(); });
+        for (int size = 900; size >= 100; size -= 100) {
+            pool.submit([&, size] {
+                record(to_string(size));
+                if (size == 900) {
+                    pool.submit([&] { record("900a"); });
+                    pool.submit([&] { record("900b"); });
+                }
+            });
+        }
+        gate.set_value();
+        pool.wait();
+        string expected = "900 900b 900a 800 700 600 500 400 300 200 100";
+        report("work-stealing pool order", joined(order) == expected, joined(order));
+    }
+    
+    // Stealing: a job spawns three more and blocks until one of them has run, which only
+    // the other worker can do; it must take the oldest, as a file's first block
+    {
+        WorkStealingPool pool(2);
+        mutex orderLock;
+        vector<string> order;
+        promise<void> spawnedAll, stolen;
+        shared_future<void> spawnedReady = spawnedAll.get_future().share();
+        future<void> stolenReady = stolen.get_future();
+        once_flag firstRun;
+        pool.submit([&] {
+            for (const char *name : {"b0", "b1", "b2"}) {
+                pool.submit([&, name] {
+                    {
+                        lock_guard<mutex> guard(orderLock);
+                        order.push_back(name);
+                    }
+                    call_once(firstRun, [&] { stolen.set_value(); });
+                });
+            }
+            spawnedAll.set_value();
+            stolenReady.wait();
+        });
+        pool.submit([spawnedReady] { spawnedReady.wait(); });
+        pool.wait();
+        report("work-stealing pool steals oldest spawned job", !order.empty() && order[0] == "b0", joined(order));
+    }
+    return allOk ? 0 : 1;
+}
+
+// Print command-line usage
+void printUsage(const char *program) {
+    cerr << "Usage: " << program << " [-c | -d] [-0..-9] [-t threads] [-b block_kb] [-w window_bits] [-L bits] [-D dictionary] [-C] [-M memory_mb] [input [output]]" << endl;
+    cerr << "       " << program << " -r [-c | -d] [options] directory [archive]" << endl;
+    cerr << "       " << program << " -d -r archive directory" << endl;
+    cerr << "       " << program << " --train dictionary sample..." << endl;
+    cerr << "       " << program << " --bench-limits file" << endl;
+    cerr << "       " << program << " --bench [corpus_mb]" << endl;
+    cerr << "       " << program << " --self-test" << endl;
+    cerr << "  -c  compress (default)" << endl;
+    cerr << "  -d  decompress" << endl;
+    cerr << "  -0..-9  compression level: 0 = Huffman only, 1-9 = LZ77 fast to thorough (default: "
+         << DEFAULT_LEVEL << ")" << endl;
+    cerr << "  -t  worker threads (default: all cores)" << endl;
+    cerr << "  -b  block size in KB (default: " << DEFAULT_BLOCK_SIZE / 1024 << ")" << endl;
+    cerr << "  -w  LZ77 window as a power of two, 10-26 (default: " << DEFAULT_WINDOW_BITS << ")" << endl;
+    cerr << "  -L  Huffman code length limit, 9-32 or 0 for none (default: " << DEFAULT_CODE_LENGTH_LIMIT << ")" << endl;
+    cerr << "  -C  context modeling: also try order-1 rANS per block (denser, slower to compress)" << endl;
+    cerr << "  -D  dictionary made by --train; files compressed with one need it to decompress" << endl;
+    cerr << "  -M  peak memory ceiling in MB; shrinks blocks and limits blocks in flight to stay under it" << endl;
+    cerr << "  -r  every file under a directory: to file.huf beside each one, or into one archive" << endl;
+    cerr << "  --train  build a dictionary (shared code tables and LZ77 history) from sample files" << endl;
+    cerr << "  --self-test  check scheduling behaviour not visible in the output" << endl;
+    cerr << "  --bench-limits  report ratio and decode speed for each code length limit" << endl;
+    cerr << "  --bench  time a built-in synthetic corpus (default: 8 MB per input) and print JSON" << endl;
+    cerr << "Input and output default to stdin and stdout. Run without arguments for the menu." << endl;
+}
+
+// Non-interactive mode for shell pipelines, e.g. `tar c dir | file_compression -c > dir.tar.huf`
+[[maybe_unused]] int runCommandLine(int argc, char *argv[]) {
+    bool decompress = false;
+    bool recursive = false;
+    CompressionOptions options;
+    vector<string> files;
+    Dictionary dictionary;
+    
+    if (argc == 2 && string(argv[1]) == "--self-test") {
+        return selfTest();
+    }
+    if (argc == 3 && string(argv[1]) == "--bench-limits") {
+        return benchmarkCodeLengthLimits(argv[2]);
+    }
+    if ((argc == 2 || argc == 3) && string(argv[1]) == "--bench") {
+        long megabytes = argc == 3 ? atol(argv[2]) : 8;
+        if (megabytes <= 0) {
+            printUsage(argv[0]);
+            return 2;
+        }
+        return benchmarkCorpus(static_cast<size_t>(megabytes) << 20);
+    }
+    if (argc >= 4 && string(argv[1]) == "--train") {
+        return trainCommand(argv[2], vector<string>(argv + 3, argv + argc));
+    }
+    
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-c") {
+            decompress = false;
+        } else if (arg == "-d") {
+            decompress = true;
+        } else if (arg.size() == 2 && arg[0] == '-' && isdigit(static_cast<unsigned char>(arg[1]))) {
+            options.level = arg[1] - '0';
+        } else if (arg == "-L" && i + 1 < argc) {
+            long value = atol(argv[++i]);
+            if (value != 0 && (value < 9 || value > 32)) {
+                printUsage(argv[0]);
+                return 2;
+            }
+            options.maxCodeLength = static_cast<int>(value);
+        } else if (arg == "-C") {
+            options.contextModel = true;
+        } else if (arg == "-r") {
+            recursive = true;
+        } else if (arg == "-D" && i + 1 < argc) {
+            if (!loadDictionary(argv[++i], dictionary)) {
+                cerr << "Error: cannot read dictionary " << argv[i] << endl;
+                return 1;
+            }
+            options.dictionary = &dictionary;
+        } else if ((arg == "-t" || arg == "-b" || arg == "-w" || arg == "-M") && i + 1 < argc) {
+            long value = atol(argv[++i]);
+            if (value <= 0 || (arg == "-w" && (value < 10 || value > 26))) {
+                printUsage(argv[0]);
+                return 2;
+            }
+            if (arg == "-t") {
+                options.threads = static_cast<unsigned>(value);
+            } else if (arg == "-b") {
+                options.blockSize = min(static_cast<size_t>(value) * 1024, MAX_BLOCK_SIZE);
+            } else if (arg == "-M") {
+                options.memoryLimit = static_cast<size_t>(value) << 20;
+            } else {
+                options.windowBits = static_cast<int>(value);
+            }
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            printUsage(argv[0]);
+            return 2;
+        } else {
+            files.push_back(arg);
+        }
+    }
+    if (files.size() > 2 || (recursive && files.empty())) {
+        printUsage(argv[0]);
+        return 2;
+    }
+    if (!decompress && !fitMemoryLimit(options)) {
+        cerr << "Error: memory limit too small for these settings (one block needs "
+             << (compressionBlockMemory(options.blockSize, options) + MEMORY_RESERVE) / (1 << 20) + 1 << " MB)" << endl;
+        return 2;
+    }
+    if (recursive) {
+        if (!decompress) return compressDirectory(files[0], files.size() == 2 ? files[1] : "", options);
+        if (files.size() == 2) return extractArchive(files[0], files[1], options);
+        return decompressDirectory(files[0], options);
+    }
+    
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    ios::sync_with_stdio(false);
+    
+    ofstream outFile;
+    if (files.size() == 2) {
+        outFile.open(files[1], ios::binary);
+        if (!outFile) {
+            cerr << "Error opening file: " << files[1] << endl;
+            return 1;
+        }
+    }
+    ostream &out = files.size() == 2 ? static_cast<ostream&>(outFile) : cout;
+    
+    if (!decompress) {
+        InputSource input;
+        if (files.empty() ? !input.openStdin() : !input.open(files[0])) {
+            cerr << "Error opening file: " << files[0] << endl;
+            return 1;
+        }
+        CompressionStats stats;
+        if (!compressStream(input, out, options, stats)) {
+            cerr << "Error: failed to write compressed output" << endl;
+            return 1;
+        }
+        return 0;
+    }
+    
+    // Seekable inputs use the block index; pipes are decoded front to back
+    bool ok;
+    if (files.empty()) {
+        ok = decompressStream(cin, out, options.threads, options.dictionary, options.memoryLimit);
+    } else {
+        ifstream inFile(files[0], ios::binary);
+        if (!inFile) {
+            cerr << "Error opening file: " << files[0] << endl;
+            return 1;
+        }
+        vector<BlockIndexEntry> index;
+        ContainerInfo info;
+        if (readBlockIndex(inFile, index, info)) {
+            ok = decompressIndexed(inFile, index, info, out, options.threads, options.dictionary, options.memoryLimit);
+        } else {
+            inFile.clear();
+            inFile.seekg(0);
+            ok = decompressStream(inFile, out, options.threads, options.dictionary, options.memoryLimit);
+        }
+    }
+    if (!ok) {
+        cerr << "Error: corrupt or truncated compressed input" << endl;
+        return 1;
+    }
+    return 0;
 }
 
-int main() {
+} // namespace
+} // namespace file_compression
+
+// Build with -DFILE_COMPRESSION_NO_MAIN to link the codec (e.g. StreamCompressor) into another program
+#ifndef FILE_COMPRESSION_NO_MAIN
+int main(int argc, char *argv[]) {
+    using namespace file_compression;
+    if (argc > 1) {
+        return runCommandLine(argc, argv);
+    }
+    
     int choice;
     string inputFile, outputFile;
     
@@ -229,7 +3739,20 @@ int main() {
                 decompressFile(inputFile, outputFile);
                 break;
                 
-            case 3:
+            case 3: {
+                uint64_t offset, length;
+                cout << "Enter compressed file name: ";
+                getline(cin, inputFile);
+                cout << "Enter output file name: ";
+                getline(cin, outputFile);
+                cout << "Enter start offset and length in bytes: ";
+                cin >> offset >> length;
+                cin.ignore();
+                extractRange(inputFile, outputFile, offset, length);
+                break;
+            }
+                
+            case 4:
                 cout << "Exiting program..." << endl;
                 break;
                 
@@ -237,11 +3760,12 @@ int main() {
                 cout << "Invalid choice! Please try again." << endl;
         }
         
-        if (choice != 3) {
+        if (choice != 4) {
             cout << "\nPress Enter to continue...";
             cin.ignore();
         }
-    } while (choice != 3);
+    } while (choice != 4);
     
     return 0;
 }
+#endif
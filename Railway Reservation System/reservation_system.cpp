@@ -9,10 +9,23 @@
 #include <sstream>
 #include <queue>
 #include <unordered_map>
+#include <bitset>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <random>
+#include <chrono>
+#include <atomic>
 using namespace std;
 
+const int SEATS_PER_COACH = 72; // Seat numbers restart in each coach of a class
+
 // ------------------- Utility Functions -------------------
 string getCurrentDateTime() {
+    static mutex clockLock; // localtime() shares one buffer between threads
+    lock_guard<mutex> guard(clockLock);
     time_t now = time(0);
     tm *ltm = localtime(&now);
     char buffer[80];
@@ -20,6 +33,13 @@ string getCurrentDateTime() {
     return string(buffer);
 }
 
+// Random number in [0, n); each thread has its own generator, so booking threads never
+// contend on shared random state
+int randomNumber(int n) {
+    thread_local mt19937 generator(random_device{}() ^ hash<thread::id>()(this_thread::get_id()));
+    return uniform_int_distribution<int>(0, n - 1)(generator);
+}
+
 // ------------------- Classes -------------------
 class User {
 private:
@@ -95,6 +115,75 @@ public:
     }
 };
 
+// Seat inventory of one coach type: one bitmap per route segment (stations[i] to
+// stations[i+1]), 64 seats to a word, where a set bit means the seat is sold for that
+// segment. A seat freed on one leg can be resold for another, and the seats free over a
+// range of segments are the complement of the OR of their bitmaps.
+class SeatMap {
+private:
+    int totalSeats;
+    int words;                 // 64-bit words per segment
+    vector<uint64_t> occupied; // Segment-major: segment s owns words [s * words, (s + 1) * words)
+
+    // Bits of word `w` that are seats free on every segment in [from, to)
+    uint64_t freeWord(int from, int to, int w) const {
+        uint64_t sold = 0;
+        for (int s = from; s < to; s++) {
+            sold |= occupied[s * words + w];
+        }
+        int seatsInWord = min(64, totalSeats - w * 64);
+        uint64_t valid = seatsInWord == 64 ? ~uint64_t(0) : (uint64_t(1) << seatsInWord) - 1;
+        return ~sold & valid;
+    }
+
+public:
+    SeatMap(int seats, int segments)
+        : totalSeats(seats), words((seats + 63) / 64), occupied(size_t(segments) * words, 0) {}
+
+    int getCapacity() const { return totalSeats; }
+
+    // Seats free from station index `from` to `to`
+    int available(int from, int to) const {
+        int count = 0;
+        for (int w = 0; w < words; w++) {
+            count += bitset<64>(freeWord(from, to, w)).count();
+        }
+        return count;
+    }
+
+    // Sell `count` seats for [from, to), lowest seat numbers first; on failure nothing changes
+    bool book(int from, int to, int count, vector<int>& seats) {
+        seats.clear();
+        for (int w = 0; w < words && (int)seats.size() < count; w++) {
+            uint64_t free = freeWord(from, to, w);
+            while (free && (int)seats.size() < count) {
+                uint64_t lowest = free & (~free + 1);
+                seats.push_back(w * 64 + bitset<64>(lowest - 1).count());
+                free ^= lowest;
+            }
+        }
+        if ((int)seats.size() < count) {
+            seats.clear();
+            return false;
+        }
+        for (int seat : seats) {
+            for (int s = from; s < to; s++) {
+                occupied[s * words + seat / 64] |= uint64_t(1) << (seat % 64);
+            }
+        }
+        return true;
+    }
+
+    // Return seats sold for [from, to)
+    void release(int from, int to, const vector<int>& seats) {
+        for (int seat : seats) {
+            for (int s = from; s < to; s++) {
+                occupied[s * words + seat / 64] &= ~(uint64_t(1) << (seat % 64));
+            }
+        }
+    }
+};
+
 class Train {
 private:
     string trainNo;
@@ -104,9 +193,10 @@ private:
     vector<string> stations;
     string departureTime;
     string arrivalTime;
-    map<string, int> availableSeats;
+    map<string, SeatMap> seatMaps; // key: coach type
     map<string, double> baseFares;
     map<string, queue<int>> waitingLists; // key: coach type, value: WL count
+    mutable map<string, mutex> coachLocks; // One per coach type, guarding its seat map and waiting list
     bool isTatkalAvailable;
 
     // Tatkal timing check (10AM-12PM previous day)
@@ -120,11 +210,14 @@ public:
     Train(string no, string n, string src, string dest, vector<string> stns, 
           string dep, string arr, map<string, int> seats, map<string, double> fares)
         : trainNo(no), name(n), source(src), destination(dest), stations(stns),
-          departureTime(dep), arrivalTime(arr), availableSeats(seats), baseFares(fares),
+          departureTime(dep), arrivalTime(arr), baseFares(fares),
           isTatkalAvailable(false) {
-        // Initialize waiting lists
-        for (auto& seat : availableSeats) {
+        // Initialize seat maps and waiting lists
+        int segments = max((int)stations.size() - 1, 1);
+        for (auto& seat : seats) {
+            seatMaps.emplace(seat.first, SeatMap(seat.second, segments));
             waitingLists[seat.first] = queue<int>();
+            coachLocks[seat.first];
         }
     }
 
@@ -136,9 +229,19 @@ public:
     vector<string> getStations() const { return stations; }
     string getDepartureTime() const { return departureTime; }
     string getArrivalTime() const { return arrivalTime; }
-    map<string, int> getAvailableSeats() const { return availableSeats; }
     bool getTatkalStatus() const { return isTatkalAvailable; }
 
+    // Seats free per coach type between two station indices (default: the whole route)
+    map<string, int> getAvailableSeats(int from = 0, int to = -1) const {
+        if (to < 0) to = max((int)stations.size() - 1, 1);
+        map<string, int> available;
+        for (const auto& seatMap : seatMaps) {
+            lock_guard<mutex> guard(coachLocks.at(seatMap.first));
+            available[seatMap.first] = seatMap.second.available(from, to);
+        }
+        return available;
+    }
+
     // Get fare with concession and tatkal premium
     double getFare(string coachType, string concession = "None", bool isTatkal = false) {
         double fare = baseFares.at(coachType);
@@ -159,14 +262,34 @@ public:
     }
 
     // Check station in route
+    bool hasCoachType(string coachType) const { return seatMaps.count(coachType) > 0; }
+
+    vector<string> getCoachTypes() const {
+        vector<string> coachTypes;
+        for (const auto& seatMap : seatMaps) {
+            coachTypes.push_back(seatMap.first);
+        }
+        return coachTypes;
+    }
+
+    int getCapacity(string coachType) const { return seatMaps.at(coachType).getCapacity(); }
+
     bool hasStation(string station) const {
         return find(stations.begin(), stations.end(), station) != stations.end();
     }
 
-    // Book seats
-    pair<bool, int> bookSeats(string coachType, int numSeats, bool isTatkal = false) {
-        if (availableSeats[coachType] >= numSeats) {
-            availableSeats[coachType] -= numSeats;
+    // Position of a station on the route, -1 if the train does not stop there
+    int getStationIndex(string station) const {
+        auto it = find(stations.begin(), stations.end(), station);
+        return it == stations.end() ? -1 : (int)(it - stations.begin());
+    }
+
+    // Book seats between two station indices; confirmed seats are returned in `seats`.
+    // Safe to call from several threads: only the coach type's own lock is taken.
+    pair<bool, int> bookSeats(string coachType, int from, int to, int numSeats, vector<int>& seats,
+                              bool isTatkal = false) {
+        lock_guard<mutex> guard(coachLocks.at(coachType));
+        if (seatMaps.at(coachType).book(from, to, numSeats, seats)) {
             return {true, 0}; // Confirmed
         } else {
             // Add to waiting list
@@ -178,9 +301,11 @@ public:
         }
     }
 
-    // Cancel booking
-    void cancelSeats(string coachType, int numSeats) {
-        availableSeats[coachType] += numSeats;
+    // Cancel booking: the seats become free again for [from, to) only
+    void cancelSeats(string coachType, int from, int to, const vector<int>& seats) {
+        lock_guard<mutex> guard(coachLocks.at(coachType));
+        seatMaps.at(coachType).release(from, to, seats);
+        int numSeats = seats.size();
         
         // Promote from waiting list if available
         while (!waitingLists[coachType].empty() && numSeats > 0) {
@@ -189,8 +314,8 @@ public:
         }
     }
 
-    // Display train details
-    void display() const {
+    // Display train details, with seats free between two station indices (default: whole route)
+    void display(int from = 0, int to = -1) const {
         cout << "\n🚂 " << name << " (" << trainNo << ")" << endl;
         cout << "------------------------------------------------" << endl;
         cout << left << setw(15) << "From:" << source << " (" << departureTime << ")" << endl;
@@ -206,10 +331,15 @@ public:
         cout << "------------------------------------------------" << endl;
         cout << left << setw(15) << "Coach Type" << setw(10) << "Seats" << setw(10) << "WL" << setw(10) << "Base Fare" << endl;
         cout << "------------------------------------------------" << endl;
-        for (const auto& seat : availableSeats) {
+        for (const auto& seat : getAvailableSeats(from, to)) {
+            size_t waiting;
+            {
+                lock_guard<mutex> guard(coachLocks.at(seat.first));
+                waiting = waitingLists.at(seat.first).size();
+            }
             cout << setw(15) << seat.first 
                  << setw(10) << seat.second
-                 << setw(10) << waitingLists.at(seat.first).size()
+                 << setw(10) << waiting
                  << "₹" << baseFares.at(seat.first) << endl;
         }
         cout << "------------------------------------------------" << endl;
@@ -231,7 +361,9 @@ private:
     string date;
     string fromStation;
     string toStation;
+    int fromIndex, toIndex; // Station positions on the train's route
     vector<Passenger> passengers;
+    vector<int> seats;      // Seat indices within the coach type, when confirmed
     string coachType;
     double totalFare;
     string status; // Confirmed/Waiting/Cancelled
@@ -246,14 +378,14 @@ private:
             "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
         string pnr;
         for (int i = 0; i < 10; ++i) {
-            pnr += alphanum[rand() % (sizeof(alphanum) - 1)];
+            pnr += alphanum[randomNumber(sizeof(alphanum) - 1)];
         }
         return pnr;
     }
 
     // Generate payment ID
     string generatePaymentId() {
-        return "PAY" + to_string(rand() % 900000 + 100000);
+        return "PAY" + to_string(randomNumber(900000) + 100000);
     }
 
 public:
@@ -271,18 +403,17 @@ public:
                 totalFare += train->getFare(coachType, passenger.getConcessionType(), isTatkal);
             }
             
-            // Book seats
-            auto bookingStatus = train->bookSeats(coachType, passengers.size(), isTatkal);
+            // Book seats for the travelled segments only
+            fromIndex = train->getStationIndex(fromStation);
+            toIndex = train->getStationIndex(toStation);
+            auto bookingStatus = train->bookSeats(coachType, fromIndex, toIndex, passengers.size(), seats, isTatkal);
             status = bookingStatus.first ? "Confirmed" : "WL" + to_string(bookingStatus.second);
             
-            // Assign seat numbers if confirmed
+            // Assign coach and seat numbers if confirmed
             if (status == "Confirmed") {
-                int startSeat = (rand() % 50) + 1;
-                string coachPrefix = coachType.substr(0, 1) + to_string(rand() % 10 + 1);
-                
                 for (size_t i = 0; i < passengers.size(); i++) {
-                    passengers[i].setCoach(coachPrefix);
-                    passengers[i].setSeatNumber(startSeat + i);
+                    passengers[i].setCoach(coachType + to_string(seats[i] / SEATS_PER_COACH + 1));
+                    passengers[i].setSeatNumber(seats[i] % SEATS_PER_COACH + 1);
                 }
             }
         }
@@ -293,6 +424,9 @@ public:
     string getDate() const { return date; }
     string getFromStation() const { return fromStation; }
     string getToStation() const { return toStation; }
+    int getFromIndex() const { return fromIndex; }
+    int getToIndex() const { return toIndex; }
+    vector<int> getSeats() const { return seats; }
     vector<Passenger> getPassengers() const { return passengers; }
     string getCoachType() const { return coachType; }
     double getTotalFare() const { return totalFare; }
@@ -301,12 +435,19 @@ public:
     string getPaymentId() const { return paymentId; }
     string getBookingTime() const { return bookingTime; }
 
-    // Cancel ticket
-    void cancel() {
-        if (status.substr(0, 2) != "WL") { // If not waiting list
-            train->cancelSeats(coachType, passengers.size());
-        }
+    // Draw a new PNR, for when the generated one is already taken
+    void reissuePNR() { pnr = generatePNR(); }
+
+    // Mark the ticket cancelled; true if it held confirmed seats, which the caller then
+    // hands back with releaseSeats() (waiting-list and cancelled tickets hold none)
+    bool markCancelled() {
+        bool heldSeats = status == "Confirmed";
         status = "Cancelled";
+        return heldSeats;
+    }
+
+    void releaseSeats() const {
+        train->cancelSeats(coachType, fromIndex, toIndex, seats);
     }
 
     // Display ticket details
@@ -345,12 +486,169 @@ public:
     }
 };
 
+const uint64_t NO_PNR = ~uint64_t(0); // Packed value of a malformed PNR
+
+// Pack a 10-character PNR of digits and letters into a base-36 number (36^10 < 2^52),
+// so PNRs compare and hash as integers; NO_PNR if it is not a well-formed PNR
+uint64_t packPNR(const string& pnr) {
+    if (pnr.size() != 10) return NO_PNR;
+    uint64_t packed = 0;
+    for (char c : pnr) {
+        int digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (toupper(c) >= 'A' && toupper(c) <= 'Z') {
+            digit = toupper(c) - 'A' + 10;
+        } else {
+            return NO_PNR;
+        }
+        packed = packed * 36 + digit;
+    }
+    return packed;
+}
+
+// Open-addressing hash table (linear probing) from packed PNR to ticket slot. Tickets
+// are never removed, only cancelled, so there are no tombstones; the table doubles
+// whenever it would become more than half full.
+class PnrIndex {
+private:
+    struct Slot {
+        uint64_t key; // NO_PNR when empty
+        int ticket;
+    };
+    vector<Slot> slots;
+    size_t count = 0;
+
+    size_t home(uint64_t key) const {
+        return (key * 0x9E3779B97F4A7C15ull) >> 32 & (slots.size() - 1);
+    }
+
+    void grow() {
+        vector<Slot> old(max<size_t>(slots.size() * 2, 1024), {NO_PNR, -1});
+        old.swap(slots);
+        for (const Slot& slot : old) {
+            if (slot.key != NO_PNR) {
+                size_t i = home(slot.key);
+                while (slots[i].key != NO_PNR) i = (i + 1) & (slots.size() - 1);
+                slots[i] = slot;
+            }
+        }
+    }
+
+public:
+    void insert(uint64_t key, int ticket) {
+        if ((count + 1) * 2 > slots.size()) grow();
+        size_t i = home(key);
+        while (slots[i].key != NO_PNR && slots[i].key != key) i = (i + 1) & (slots.size() - 1);
+        if (slots[i].key == NO_PNR) count++;
+        slots[i] = {key, ticket};
+    }
+
+    // Ticket slot for a packed PNR, -1 if there is none
+    int find(uint64_t key) const {
+        if (slots.empty() || key == NO_PNR) return -1;
+        for (size_t i = home(key); slots[i].key != NO_PNR; i = (i + 1) & (slots.size() - 1)) {
+            if (slots[i].key == key) return slots[i].ticket;
+        }
+        return -1;
+    }
+};
+
+// Stop of a train at a station, as kept in the station index
+struct RouteStop {
+    int train;    // Index into trains
+    int sequence; // Position of the station on that train's route
+};
+
+// A booking as submitted to the request-driven core (no console I/O)
+struct BookingRequest {
+    string trainNo;
+    string date;
+    string from;
+    string to;
+    string coachType;
+    vector<Passenger> passengers;
+    bool isTatkal;
+};
+
+struct BookingResult {
+    bool accepted;  // False if the request was invalid; see error
+    string pnr;
+    string status;  // Confirmed or WLn
+    string error;
+};
+
 class RailwayReservationSystem {
 private:
-    vector<Train> trains;
-    vector<Ticket> tickets;
+    // One shard of the ticket registry: the tickets whose PNR hashes to it, their PNR
+    // index and the lock guarding both (and the tickets' status changes)
+    struct TicketShard {
+        deque<Ticket> tickets;
+        PnrIndex pnrIndex; // PNR to position in tickets
+        mutable shared_mutex lock;
+    };
+    static const int TICKET_SHARD_BITS = 6;
+
+    // Trains and tickets live in deques so that references stay valid as more are added.
+    // trainLock guards the train list and station index (written only by addNewTrain).
+    // Tickets are spread over shards by PNR hash, each with its own lock, so concurrent
+    // bookings and cancellations rarely meet on a lock and an index resize stalls only
+    // one shard. Seats are guarded per coach type inside each Train, and no lock is held
+    // while taking another: bookings on different trains or classes never wait for each other.
+    deque<Train> trains;
+    TicketShard ticketShards[1 << TICKET_SHARD_BITS];
     unordered_map<string, User> users;
     User* currentUser;
+    mutable shared_mutex trainLock;
+
+    TicketShard& shardOf(uint64_t packedPNR) {
+        return ticketShards[(packedPNR * 0x9E3779B97F4A7C15ull) >> (64 - TICKET_SHARD_BITS)];
+    }
+
+    // Station index: every station gets an ID, and each ID a postings list of the trains
+    // stopping there. Trains are only ever appended, so each list stays sorted by train.
+    unordered_map<string, int> stationIds;
+    vector<vector<RouteStop>> stationStops;
+
+    // Add a train's stops to the station index
+    void indexTrain(int trainIndex) {
+        vector<string> stations = trains[trainIndex].getStations();
+        for (int i = 0; i < (int)stations.size(); i++) {
+            auto id = stationIds.emplace(stations[i], (int)stationStops.size());
+            if (id.second) {
+                stationStops.emplace_back();
+            }
+            stationStops[id.first->second].push_back({trainIndex, i});
+        }
+    }
+
+    // Trains that stop at `from` and later at `to`, found by intersecting the two
+    // stations' postings lists; each match carries both stop positions
+    vector<pair<RouteStop, RouteStop>> findTrainsBetween(string from, string to) const {
+        shared_lock<shared_mutex> guard(trainLock);
+        vector<pair<RouteStop, RouteStop>> matches;
+        auto fromId = stationIds.find(from), toId = stationIds.find(to);
+        if (fromId == stationIds.end() || toId == stationIds.end()) {
+            return matches;
+        }
+        const vector<RouteStop>& a = stationStops[fromId->second];
+        const vector<RouteStop>& b = stationStops[toId->second];
+        size_t i = 0, j = 0;
+        while (i < a.size() && j < b.size()) {
+            if (a[i].train < b[j].train) {
+                i++;
+            } else if (b[j].train < a[i].train) {
+                j++;
+            } else {
+                if (a[i].sequence < b[j].sequence) {
+                    matches.push_back({a[i], b[j]});
+                }
+                i++;
+                j++;
+            }
+        }
+        return matches;
+    }
 
     // Initialize with sample data
     void initializeData() {
@@ -366,14 +664,18 @@ private:
         map<string, double> shatabdiFares = {{"CC", 1200}, {"EC", 2000}};
         trains.emplace_back("12007", "Shatabdi Express", "Chennai", "Hyderabad", 
                           shatabdiStations, "06:00", "14:30", shatabdiSeats, shatabdiFares);
+        for (int i = 0; i < (int)trains.size(); i++) {
+            indexTrain(i);
+        }
 
         // Sample users
-        users["admin"] = User("admin", "admin123", "Admin User", "9876543210", "admin@irctc.com", true);
-        users["rahul"] = User("rahul", "pass123", "Rahul Sharma", "9876543211", "rahul@example.com");
+        users.emplace("admin", User("admin", "admin123", "Admin User", "9876543210", "admin@irctc.com", true));
+        users.emplace("rahul", User("rahul", "pass123", "Rahul Sharma", "9876543211", "rahul@example.com"));
     }
 
     // Find train by number
     Train* findTrain(string trainNo) {
+        shared_lock<shared_mutex> guard(trainLock);
         for (auto& train : trains) {
             if (train.getTrainNo() == trainNo) {
                 return &train;
@@ -382,32 +684,61 @@ private:
         return nullptr;
     }
 
+    // Why a journey cannot be booked on a train, or "" if the train runs from `from` to `to`
+    string journeyError(const Train* train, const string& from, const string& to) const {
+        if (!train) {
+            return "Invalid train number";
+        }
+        int fromIndex = train->getStationIndex(from);
+        int toIndex = train->getStationIndex(to);
+        if (fromIndex < 0 || toIndex < 0) {
+            return "Selected stations not on this train's route";
+        }
+        if (fromIndex >= toIndex) {
+            return "This train does not run from " + from + " to " + to;
+        }
+        return "";
+    }
+
     // Find ticket by PNR
-    Ticket* findTicket(string pnr) {
-        for (auto& ticket : tickets) {
-            if (ticket.getPNR() == pnr) {
-                return &ticket;
+    Ticket* findTicket(const string& pnr) {
+        uint64_t packed = packPNR(pnr);
+        TicketShard& shard = shardOf(packed);
+        shared_lock<shared_mutex> guard(shard.lock);
+        int slot = shard.pnrIndex.find(packed);
+        return slot < 0 ? nullptr : &shard.tickets[slot];
+    }
+
+    // Add a booked ticket to its PNR's shard, under a PNR no other ticket has
+    Ticket& addTicket(Ticket ticket) {
+        while (true) {
+            uint64_t packed = packPNR(ticket.getPNR());
+            TicketShard& shard = shardOf(packed);
+            unique_lock<shared_mutex> guard(shard.lock);
+            if (shard.pnrIndex.find(packed) < 0) {
+                shard.tickets.push_back(move(ticket));
+                shard.pnrIndex.insert(packed, shard.tickets.size() - 1);
+                return shard.tickets.back();
             }
+            guard.unlock();
+            ticket.reissuePNR();
         }
-        return nullptr;
     }
 
     // Display available trains between stations
     void displayAvailableTrains(string from, string to, string date) {
         cout << "\nAvailable Trains from " << from << " to " << to << " on " << date << ":" << endl;
         cout << "==================================================================" << endl;
-        bool found = false;
+        auto matches = findTrainsBetween(from, to);
         
-        for (auto& train : trains) {
-            if (train.hasStation(from) && train.hasStation(to)) {
-                found = true;
-                // Enable Tatkal if applicable
-                train.enableTatkal(date);
-                train.display();
-            }
+        for (const auto& match : matches) {
+            Train& train = trains[match.first.train];
+            // Enable Tatkal if applicable
+            train.enableTatkal(date);
+            train.display(match.first.sequence, match.second.sequence);
         }
         
-        if (!found) {
+        if (matches.empty()) {
             cout << "No trains found for this route." << endl;
         }
     }
@@ -421,8 +752,9 @@ private:
         cin >> password;
         cin.ignore();
 
-        if (users.find(username) != users.end() && users[username].authenticate(password)) {
-            currentUser = &users[username];
+        auto it = users.find(username);
+        if (it != users.end() && it->second.authenticate(password)) {
+            currentUser = &it->second;
             return true;
         }
         return false;
@@ -452,8 +784,7 @@ private:
         cout << "Email: ";
         cin >> email;
         
-        users[username] = User(username, password, name, phone, email);
-        currentUser = &users[username];
+        currentUser = &users.emplace(username, User(username, password, name, phone, email)).first->second;
         cout << "\n✅ Registration successful! You are now logged in." << endl;
     }
 
@@ -462,6 +793,159 @@ public:
         initializeData();
     }
 
+    // Book a ticket from a request, without any console I/O. Safe to call from many
+    // threads at once: only the chosen coach type's lock is held while seats are taken.
+    BookingResult bookRequest(const BookingRequest& request) {
+        Train* train = findTrain(request.trainNo);
+        string error = journeyError(train, request.from, request.to);
+        if (!error.empty()) {
+            return {false, "", "", error};
+        }
+        if (!train->hasCoachType(request.coachType)) {
+            return {false, "", "", "Invalid coach type"};
+        }
+        if (request.passengers.empty()) {
+            return {false, "", "", "No passengers"};
+        }
+        
+        Ticket ticket(train, request.date, request.from, request.to, request.passengers,
+                      request.coachType, request.isTatkal);
+        string status = ticket.getStatus();
+        return {true, addTicket(move(ticket)).getPNR(), status, ""};
+    }
+
+    // Cancel a ticket by PNR; false if there is no such ticket or it is already cancelled.
+    // Safe to call from many threads at once.
+    bool cancelBooking(const string& pnr) {
+        uint64_t packed = packPNR(pnr);
+        TicketShard& shard = shardOf(packed);
+        Ticket* ticket;
+        bool heldSeats;
+        {
+            unique_lock<shared_mutex> guard(shard.lock);
+            int slot = shard.pnrIndex.find(packed);
+            if (slot < 0 || shard.tickets[slot].getStatus() == "Cancelled") {
+                return false;
+            }
+            ticket = &shard.tickets[slot];
+            heldSeats = ticket->markCancelled();
+        }
+        // The seats are released after the shard lock is dropped; the ticket's route and
+        // seats never change after booking, and it is already marked cancelled
+        if (heldSeats) {
+            ticket->releaseSeats();
+        }
+        return true;
+    }
+
+    // Book and cancel at random from many threads at once, then check that no seat was
+    // sold twice on any segment and that every seat map agrees with the confirmed tickets
+    bool runStressTest(int numThreads, int requestsPerThread) {
+        vector<Train*> routes;
+        {
+            shared_lock<shared_mutex> guard(trainLock);
+            for (auto& train : trains) {
+                routes.push_back(&train);
+            }
+        }
+        
+        atomic<int> confirmed(0), waitlisted(0), cancelled(0);
+        auto start = chrono::steady_clock::now();
+        vector<thread> workers;
+        for (int t = 0; t < numThreads; t++) {
+            workers.emplace_back([&]() {
+                vector<string> booked;
+                for (int i = 0; i < requestsPerThread; i++) {
+                    // One request in five cancels one of this worker's confirmed tickets
+                    if (!booked.empty() && randomNumber(5) == 0) {
+                        swap(booked[randomNumber(booked.size())], booked.back());
+                        if (cancelBooking(booked.back())) cancelled++;
+                        booked.pop_back();
+                        continue;
+                    }
+                    Train* train = routes[randomNumber(routes.size())];
+                    vector<string> stations = train->getStations();
+                    vector<string> coachTypes = train->getCoachTypes();
+                    int from = randomNumber(stations.size() - 1);
+                    int to = from + 1 + randomNumber(stations.size() - 1 - from);
+                    
+                    BookingRequest request;
+                    request.trainNo = train->getTrainNo();
+                    request.date = "01-01-2030";
+                    request.from = stations[from];
+                    request.to = stations[to];
+                    request.coachType = coachTypes[randomNumber(coachTypes.size())];
+                    request.isTatkal = randomNumber(2) == 0;
+                    int numPassengers = randomNumber(4) + 1;
+                    for (int p = 0; p < numPassengers; p++) {
+                        request.passengers.emplace_back("Passenger", 30, 'M', "Lower");
+                    }
+                    
+                    BookingResult result = bookRequest(request);
+                    if (result.status == "Confirmed") {
+                        confirmed++;
+                        booked.push_back(result.pnr);
+                    } else {
+                        waitlisted++;
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        
+        // Count the confirmed tickets holding each seat on each segment
+        map<pair<Train*, string>, vector<vector<int>>> holders;
+        bool ok = true;
+        for (const auto& shard : ticketShards) {
+            for (const auto& ticket : shard.tickets) {
+                if (ticket.getStatus() != "Confirmed") continue;
+                auto& segments = holders[{ticket.getTrain(), ticket.getCoachType()}];
+                if (segments.empty()) {
+                    int capacity = ticket.getTrain()->getCapacity(ticket.getCoachType());
+                    segments.assign(ticket.getTrain()->getStations().size() - 1, vector<int>(capacity, 0));
+                }
+                for (int s = ticket.getFromIndex(); s < ticket.getToIndex(); s++) {
+                    for (int seat : ticket.getSeats()) {
+                        if (++segments[s][seat] > 1) {
+                            cout << "❌ Seat " << seat << " of " << ticket.getCoachType() << " on train "
+                                 << ticket.getTrain()->getTrainNo() << " sold twice on segment " << s << endl;
+                            ok = false;
+                        }
+                    }
+                }
+            }
+        }
+        for (Train* train : routes) {
+            for (const string& coachType : train->getCoachTypes()) {
+                auto it = holders.find({train, coachType});
+                int segmentCount = train->getStations().size() - 1;
+                for (int s = 0; s < segmentCount; s++) {
+                    int sold = 0;
+                    if (it != holders.end()) {
+                        sold = count_if(it->second[s].begin(), it->second[s].end(), [](int n) { return n > 0; });
+                    }
+                    if (train->getAvailableSeats(s, s + 1).at(coachType) != train->getCapacity(coachType) - sold) {
+                        cout << "❌ Seat map of " << coachType << " on train " << train->getTrainNo()
+                             << " disagrees with tickets on segment " << s << endl;
+                        ok = false;
+                    }
+                }
+            }
+        }
+        
+        int total = numThreads * requestsPerThread;
+        cout << "Stress test: " << numThreads << " threads, " << total << " requests in "
+             << fixed << setprecision(3) << seconds << " s (" << (int)(total / max(seconds, 1e-9))
+             << " requests/s)" << endl;
+        cout << "Confirmed: " << confirmed << ", waiting list: " << waitlisted
+             << ", cancelled: " << cancelled << endl;
+        cout << (ok ? "✅ No seat sold twice; seat maps match tickets" : "❌ Overbooking detected") << endl;
+        return ok;
+    }
+
     // Login menu
     bool showLoginMenu() {
         int choice;
@@ -496,58 +980,49 @@ public:
         } while (true);
     }
 
-    // Book ticket
+    // Book ticket: the details are collected here and booked through bookRequest, which
+    // does all the validation; the route is checked early only to list coach availability
     void bookTicket() {
-        string from, to, date, trainNo, coachType;
+        BookingRequest request;
         
         // Get journey details
         cout << "\n🚉 Enter Journey Details" << endl;
         cout << "From Station: ";
-        getline(cin >> ws, from);
+        getline(cin >> ws, request.from);
         cout << "To Station: ";
-        getline(cin, to);
+        getline(cin, request.to);
         cout << "Date of Journey (DD-MM-YYYY): ";
-        getline(cin, date);
+        getline(cin, request.date);
         
         // Show available trains
-        displayAvailableTrains(from, to, date);
+        displayAvailableTrains(request.from, request.to, request.date);
         
         // Select train
         cout << "\nEnter Train Number: ";
-        getline(cin, trainNo);
-        Train* selectedTrain = findTrain(trainNo);
-        if (!selectedTrain) {
-            cout << "❌ Invalid train number!" << endl;
-            return;
-        }
-        
-        // Check if stations are valid
-        if (!selectedTrain->hasStation(from) || !selectedTrain->hasStation(to)) {
-            cout << "❌ Selected stations not on this train's route!" << endl;
+        getline(cin, request.trainNo);
+        Train* selectedTrain = findTrain(request.trainNo);
+        string error = journeyError(selectedTrain, request.from, request.to);
+        if (!error.empty()) {
+            cout << "❌ " << error << "!" << endl;
             return;
         }
         
         // Select coach type
         cout << "\nAvailable Coach Types:" << endl;
-        for (const auto& seat : selectedTrain->getAvailableSeats()) {
-            cout << seat.first << " (₹" << selectedTrain->getFare(seat.first) << ") ";
+        for (const auto& seat : selectedTrain->getAvailableSeats(selectedTrain->getStationIndex(request.from),
+                                                                 selectedTrain->getStationIndex(request.to))) {
+            cout << seat.first << " (₹" << selectedTrain->getFare(seat.first) << ", " << seat.second << " free) ";
         }
         cout << "\nEnter Coach Type: ";
-        getline(cin, coachType);
-        
-        // Check coach type
-        if (selectedTrain->getAvailableSeats().find(coachType) == selectedTrain->getAvailableSeats().end()) {
-            cout << "❌ Invalid coach type!" << endl;
-            return;
-        }
+        getline(cin, request.coachType);
         
         // Tatkal booking option
-        bool isTatkal = false;
+        request.isTatkal = false;
         if (selectedTrain->getTatkalStatus()) {
             char tatkalChoice;
             cout << "Tatkal booking available (30% premium). Book Tatkal? (y/n): ";
             cin >> tatkalChoice;
-            isTatkal = (tatkalChoice == 'y' || tatkalChoice == 'Y');
+            request.isTatkal = (tatkalChoice == 'y' || tatkalChoice == 'Y');
             cin.ignore();
         }
         
@@ -557,7 +1032,6 @@ public:
         cin >> numPassengers;
         cin.ignore();
         
-        vector<Passenger> passengers;
         for (int i = 0; i < numPassengers; i++) {
             string name, berthPref, concession;
             int age;
@@ -585,16 +1059,21 @@ public:
                 getline(cin, concession);
             }
             
-            passengers.emplace_back(name, age, gender, berthPref, concession);
+            request.passengers.emplace_back(name, age, gender, berthPref, concession);
         }
         
         // Create ticket
-        tickets.emplace_back(selectedTrain, date, from, to, passengers, coachType, isTatkal);
+        BookingResult result = bookRequest(request);
+        if (!result.accepted) {
+            cout << "❌ " << result.error << "!" << endl;
+            return;
+        }
+        Ticket& ticket = *findTicket(result.pnr);
         
         // Display ticket and send confirmation
         cout << "\n✅ Ticket Booked Successfully!" << endl;
-        tickets.back().display();
-        tickets.back().sendConfirmation(*currentUser);
+        ticket.display();
+        ticket.sendConfirmation(*currentUser);
     }
 
     // Cancel ticket
@@ -609,7 +1088,10 @@ public:
             return;
         }
         
-        ticket->cancel();
+        if (!cancelBooking(pnr)) {
+            cout << "❌ Ticket is already cancelled!" << endl;
+            return;
+        }
         cout << "\n✅ Ticket cancelled successfully!" << endl;
         ticket->display();
         
@@ -734,7 +1216,9 @@ public:
             cin.ignore();
         }
         
+        unique_lock<shared_mutex> guard(trainLock);
         trains.emplace_back(no, name, src, dest, stations, dep, arr, seats, fares);
+        indexTrain(trains.size() - 1);
         cout << "\n✅ Train added successfully!" << endl;
     }
 
@@ -803,9 +1287,20 @@ public:
     }
 };
 
-int main() {
+int main(int argc, char* argv[]) {
     RailwayReservationSystem irctc;
     
+    // Non-interactive concurrency check: --stress [threads] [requests per thread]
+    if (argc >= 2 && string(argv[1]) == "--stress") {
+        int threads = argc >= 3 ? atoi(argv[2]) : max((int)thread::hardware_concurrency(), 2);
+        int requests = argc >= 4 ? atoi(argv[3]) : 20000;
+        if (threads <= 0 || requests <= 0) {
+            cout << "Usage: " << argv[0] << " --stress [threads] [requests_per_thread]" << endl;
+            return 2;
+        }
+        return irctc.runStressTest(threads, requests) ? 0 : 1;
+    }
+    
     while (irctc.showLoginMenu()) {
         irctc.showMainMenu();
     }